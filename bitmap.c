@@ -15,8 +15,13 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include "bitmap.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 void cc_gray_bitmap_alloc(CcGrayBitmap* b)
 {
     assert(b->w >= 0);
@@ -35,7 +40,7 @@ void cc_gray_bitmap_free(CcGrayBitmap *b)
 }
 
 static
-void fill_(char *bytes, CcDim w, CcDim h, size_t stride, CcPixel x)
+void fill_(char *bytes, int w, int h, size_t stride, CcPixel x)
 {
     while (h) {
         CcPixel *data = (CcPixel *)bytes;
@@ -49,26 +54,21 @@ void fill_(char *bytes, CcDim w, CcDim h, size_t stride, CcPixel x)
 
 void cc_bitmap_clear(CcBitmap* b, CcPixel color)
 {
-    size_t N = b->w * b->h;
-
-    switch (color)
+    if (!cc_bitmap_is_packed(b) || (color != 0 && color != 0xFFFFFFFF))
     {
-    case 0:
-        memset(b->data, 0, sizeof(CcPixel) * N);
-        break;
-    case 0xFFFFFFFF:
-        memset(b->data, 0xFF, sizeof(CcPixel) * N);
-        break;
-    default:
-        fill_((char *)b->data, b->w, b->h, b->w * sizeof(CcPixel), color);
-        break;
+        fill_((char *)b->data, b->w, b->h, b->stride, color);
+        return;
     }
+
+    size_t N = b->w * b->h;
+    memset(b->data, color & 0xFF, sizeof(CcPixel) * N);
 }
 
 void cc_bitmap_alloc(CcBitmap* b)
 {
     assert(b->w >= 0);
     assert(b->h >= 0);
+    b->stride = b->w * sizeof(CcPixel);
     b->data = malloc(b->w * b->h * sizeof(CcPixel));
 }
 
@@ -85,6 +85,27 @@ void cc_bitmap_copy(const CcBitmap *src, CcBitmap *dst)
     cc_bitmap_blit_unsafe(src, dst, 0, 0, 0, 0, src->w, src->h, COLOR_BLEND_REPLACE);
 }
 
+void cc_bitmap_shift(CcBitmap* b, int dx, int dy)
+{
+    int w = b->w - abs(dx);
+    int h = b->h - abs(dy);
+    if (w <= 0 || h <= 0) return;
+
+    int src_x = MAX(dx, 0);
+    int dst_x = MAX(-dx, 0);
+
+    // go against the move, so rows are read before they are written.
+    for (int i = 0; i < h; ++i)
+    {
+        int y = dy >= 0 ? i : h - 1 - i;
+        memmove(
+            cc_bitmap_row(b, y + MAX(-dy, 0)) + dst_x,
+            cc_bitmap_row(b, y + MAX(dy, 0)) + src_x,
+            w * sizeof(CcPixel)
+        );
+    }
+}
+
 static inline
 void interleave_channel_(
         const char * restrict src,
@@ -108,29 +129,54 @@ void interleave_channel_(
 void cc_bitmap_copy_channel(CcBitmap* b, size_t channel_index, const CcGrayBitmap *channel)
 {
     char *buffer = (char *)b->data;
-    interleave_channel_(channel->data, buffer + channel_index, channel->stride, sizeof(CcPixel) * b->w, b->w, b->h);
+    interleave_channel_(channel->data, buffer + channel_index, channel->stride, b->stride, b->w, b->h);
 }
 
 void cc_bitmap_replace(CcBitmap* b, CcPixel old_color, CcPixel new_color)
 {
-    CcPixel *data = b->data;
+    for (int y = 0; y < b->h; ++y)
+    {
+        CcPixel *data = cc_bitmap_row(b, y);
+        for (int x = 0; x < b->w; ++x)
+        {
+            if (data[x] == old_color)
+                data[x] = new_color;
+        }
+    }
+}
 
-    size_t n = b->w * b->h;
-    for (size_t i = 0; i < n; ++i)
+CcCoverage cc_bitmap_coverage(const CcBitmap* b)
+{
+    // AND of all pixels tells if every alpha is 255,
+    // OR tells if every alpha is 0.
+    CcPixel all = COLOR_ALPHA_MASK;
+    CcPixel any = 0;
+    for (int y = 0; y < b->h; ++y)
     {
-        if (data[i] == old_color)
-            data[i] = new_color;
+        const CcPixel *data = cc_bitmap_row(b, y);
+        for (int x = 0; x < b->w; ++x)
+        {
+            all &= data[x];
+            any |= data[x];
+        }
+
+        if ((all & COLOR_ALPHA_MASK) != COLOR_ALPHA_MASK && (any & COLOR_ALPHA_MASK) != 0) return COVERAGE_MIXED;
     }
+
+    if ((any & COLOR_ALPHA_MASK) == 0) return COVERAGE_CLEAR;
+    if ((all & COLOR_ALPHA_MASK) == COLOR_ALPHA_MASK) return COVERAGE_OPAQUE;
+    return COVERAGE_MIXED;
 }
 
 void cc_bitmap_swap_channels(CcBitmap *b)
 {
-    CcPixel *data = b->data;
-
-    size_t n = b->w * b->h;
-    for (size_t i = 0; i < n; ++i)
+    for (int y = 0; y < b->h; ++y)
     {
-        data[i] = cc_color_swap(data[i]);
+        CcPixel *data = cc_bitmap_row(b, y);
+        for (int x = 0; x < b->w; ++x)
+        {
+            data[x] = cc_color_swap(data[x]);
+        }
     }
 }
 
@@ -201,18 +247,12 @@ void blit_blend_(
         size_t dst_stride,
         int w,
         int h,
-        CcPixel (*blend)(CcPixel, CcPixel)
+        CcBlendRow blend_row
         ) {
 
     while (h)
     {
-        const CcPixel *src_data = (CcPixel *)src;
-        CcPixel *dst_data = (CcPixel *)dst;
-
-        for (int x = 0; x < w; ++x)
-        {
-            dst_data[x] = blend(src_data[x], dst_data[x]);
-        }
+        blend_row((const CcPixel *)src, (CcPixel *)dst, w);
         src += src_stride;
         dst += dst_stride;
         --h;
@@ -236,26 +276,18 @@ void cc_bitmap_blit_unsafe(
 
     char *src_bytes = cc_bitmap_bytes_at(src, src_x, src_y);
     char *dst_bytes = cc_bitmap_bytes_at(dst, dst_x, dst_y);
-    size_t src_stride = src->w * sizeof(CcPixel);
-    size_t dst_stride = dst->w * sizeof(CcPixel);
+    size_t src_stride = src->stride;
+    size_t dst_stride = dst->stride;
 
-    switch (blend)
+    // choose the kernel once, not per pixel
+    CcBlendRow blend_row = cc_color_blend_row(blend);
+    if (blend_row)
     {
-        case COLOR_BLEND_REPLACE:
-            blit_copy_(src_bytes, dst_bytes, src_stride, dst_stride, w, h);
-            break;
-        case COLOR_BLEND_OVERLAY:
-            blit_blend_(src_bytes, dst_bytes, src_stride, dst_stride, w, h, cc_color_blend_overlay);
-            break;
-        case COLOR_BLEND_FULL:
-            blit_blend_(src_bytes, dst_bytes, src_stride, dst_stride, w, h, cc_color_blend_full);
-            break;
-        case COLOR_BLEND_INVERT:
-            blit_blend_(src_bytes, dst_bytes, src_stride, dst_stride, w, h, cc_color_blend_invert);
-            break;
-        case COLOR_BLEND_MULTIPLY:
-            blit_blend_(src_bytes, dst_bytes, src_stride, dst_stride, w, h, cc_color_blend_multiply);
-            break;
+        blit_blend_(src_bytes, dst_bytes, src_stride, dst_stride, w, h, blend_row);
+    }
+    else
+    {
+        blit_copy_(src_bytes, dst_bytes, src_stride, dst_stride, w, h);
     }
 }
 
@@ -347,28 +379,28 @@ void interp_linear_(
     }
 }
 
-void cc_bitmap_draw_spray(CcBitmap* b, int cx, int cy, int r, int density, CcPixel color)
+void cc_bitmap_draw_spray(CcBitmap* b, int cx, int cy, int r, int density, CcPixel color, CcRandom* random)
 {
-    CcRect rect = {
-        cx - r, cy - r, 2 * r, 2 * r
-    };
-    cc_rect_intersect(rect, cc_bitmap_rect(b), &rect);
+    if (r <= 0) return;
 
-    CcPixel *data = b->data;
+    // paint density% of the disc's area, as random points.
+    // cost follows the number of points, not the size of the disc.
+    int count = (int)(M_PI * r * r * density / 100.0 + 0.5);
 
-    for (int y = rect.y; y < rect.y + rect.h; ++y)
+    while (count > 0)
     {
-        for (int x = rect.x; x < rect.x + rect.w; ++x)
-        {
-            int64_t d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
-            if (d < r * r)
-            {
-                if (rand() % 1000 < density * 10)
-                {
-                    data[x + y * b->w] = color;
-                }
-            }
-        }
+        int dx = (int)cc_random_below(random, 2 * r) - r;
+        int dy = (int)cc_random_below(random, 2 * r) - r;
+
+        // same disc as cc_bitmap_draw_circle
+        if (dx * dx + dy * dy >= r * r) continue;
+        --count;
+
+        int x = cx + dx;
+        int y = cy + dy;
+        if (x < 0 || y < 0 || x >= b->w || y >= b->h) continue;
+
+        cc_bitmap_row(b, y)[x] = color;
     }
 }
 
@@ -379,15 +411,15 @@ void cc_bitmap_draw_circle(CcBitmap* b, int cx, int cy, int r, CcPixel color)
     };
     cc_rect_intersect(rect, cc_bitmap_rect(b), &rect);
 
-    CcPixel *data = b->data;
     for (int y = rect.y; y < rect.y + rect.h; ++y)
     {
+        CcPixel *data = cc_bitmap_row(b, y);
         for (int x = rect.x; x < rect.x + rect.w; ++x)
         {
             int64_t d = (x - cx) * (x - cx) + (y - cy) * (y - cy);
             if (d < r * r)
             {
-                data[x + y * b->w] = color;
+                data[x] = color;
             }
         }
     }
@@ -398,37 +430,121 @@ void cc_bitmap_draw_square(CcBitmap* b, int cx, int cy, int d, CcPixel color)
     CcRect rect = {
         cx - d / 2, cy - d / 2, d, d
     };
-    cc_rect_intersect(rect, cc_bitmap_rect(b), &rect);
+    if (!cc_rect_intersect(rect, cc_bitmap_rect(b), &rect)) return;
+
+    fill_(cc_bitmap_bytes_at(b, rect.x, rect.y), rect.w, rect.h, b->stride, color);
+}
+
+// Strokes are the union of a stamp (square or circle) placed at each point of the line.
+// Stamping directly rewrites most pixels many times over,
+// so instead each stamp only widens a span per row, and the rows are filled once at the end.
+// The result is exactly the same as stamping.
+typedef struct
+{
+    // stamp row top + i covers [cx + left[i], cx + right[i]]
+    int top;
+    int h;
+    int *left;
+    int *right;
+
+    // union of the stamps for bitmap rows [min_y, min_y + rows)
+    int min_y;
+    int rows;
+    int *span_min;
+    int *span_max;
+} Sweep;
 
-    CcPixel *data = b->data;
-    for (int y = 0; y < rect.h; ++y)
+static
+void sweep_init_(Sweep* sweep, const CcBitmap* b, int y1, int y2, int top, int h)
+{
+    sweep->top = top;
+    sweep->h = h;
+
+    int min_y = MAX(MIN(y1, y2) + top, 0);
+    int max_y = MIN(MAX(y1, y2) + top + h, b->h);
+
+    sweep->min_y = min_y;
+    sweep->rows = MAX(max_y - min_y, 0);
+
+    int *buffer = malloc(sizeof(int) * (2 * h + 2 * sweep->rows));
+    sweep->left = buffer;
+    sweep->right = buffer + h;
+    sweep->span_min = buffer + 2 * h;
+    sweep->span_max = buffer + 2 * h + sweep->rows;
+
+    for (int i = 0; i < sweep->rows; ++i)
     {
-        for (int x = 0; x < rect.w; ++x)
-        {
-            data[(rect.x + x) + (rect.y + y) * b->w] = color;
-        }
+        sweep->span_min[i] = INT_MAX;
+        sweep->span_max[i] = INT_MIN;
     }
 }
 
-static inline
-void interp_square_helper_(CcBitmap* b, int x, int y, int d, CcPixel c, void* ctx) {
-    cc_bitmap_draw_square(b, x, y, d, c);
+static
+void sweep_stamp_(CcBitmap* b, int x, int y, int w, CcPixel c, void* ctx)
+{
+    Sweep* sweep = ctx;
+
+    int start = MAX(y + sweep->top, sweep->min_y);
+    int end = MIN(y + sweep->top + sweep->h, sweep->min_y + sweep->rows);
+
+    for (int row = start; row < end; ++row)
+    {
+        int i = row - (y + sweep->top);
+        int j = row - sweep->min_y;
+        sweep->span_min[j] = MIN(sweep->span_min[j], x + sweep->left[i]);
+        sweep->span_max[j] = MAX(sweep->span_max[j], x + sweep->right[i]);
+    }
 }
-   
-void cc_bitmap_interp_square(CcBitmap* b, int x1, int y1, int x2, int y2, int width, CcPixel color)
+
+static
+void sweep_fill_(Sweep* sweep, CcBitmap* b, CcPixel color)
 {
-    interp_linear_(b, x1, y1, x2, y2, width, color, interp_square_helper_, NULL);
+    for (int j = 0; j < sweep->rows; ++j)
+    {
+        int start = MAX(sweep->span_min[j], 0);
+        int end = MIN(sweep->span_max[j], b->w - 1);
+        if (start > end) continue;
+
+        fill_(cc_bitmap_bytes_at(b, start, sweep->min_y + j), end - start + 1, 1, 0, color);
+    }
+
+    free(sweep->left);
 }
 
+void cc_bitmap_interp_square(CcBitmap* b, int x1, int y1, int x2, int y2, int width, CcPixel color)
+{
+    // same as cc_bitmap_draw_square
+    if (width <= 0) return;
 
-static inline
-void interp_circle_helper_(CcBitmap* b, int x, int y, int w, CcPixel c, void* ctx) {
-    cc_bitmap_draw_circle(b, x, y, w, c);
+    Sweep sweep;
+    sweep_init_(&sweep, b, y1, y2, -(width / 2), width);
+    for (int i = 0; i < width; ++i)
+    {
+        sweep.left[i] = -(width / 2);
+        sweep.right[i] = -(width / 2) + width - 1;
+    }
+
+    interp_linear_(b, x1, y1, x2, y2, width, color, sweep_stamp_, &sweep);
+    sweep_fill_(&sweep, b, color);
 }
- 
+
 void cc_bitmap_interp_circle(CcBitmap* b, int x1, int y1, int x2, int y2, int radius, CcPixel color)
 {
-    interp_linear_(b, x1, y1, x2, y2, radius, color, interp_circle_helper_, NULL);
+    // same as cc_bitmap_draw_circle: dx^2 + dy^2 < r^2
+    if (radius <= 0) return;
+
+    Sweep sweep;
+    sweep_init_(&sweep, b, y1, y2, -(radius - 1), 2 * radius - 1);
+    for (int i = 0; i < sweep.h; ++i)
+    {
+        int dy = sweep.top + i;
+        int k = (int)isqrt(radius * radius - dy * dy - 1);
+        sweep.left[i] = -k;
+        sweep.right[i] = k;
+    }
+
+    interp_linear_(b, x1, y1, x2, y2, radius, color, sweep_stamp_, &sweep);
+    sweep_fill_(&sweep, b, color);
 }
 
 static inline
@@ -475,18 +591,9 @@ void cc_bitmap_fill_rect(CcBitmap* dst, int x1, int y1, int x2, int y2, CcPixel
     };
 
     CcRect to_fill;
-    cc_rect_intersect(r, cc_bitmap_rect(dst), &to_fill);
+    if (!cc_rect_intersect(r, cc_bitmap_rect(dst), &to_fill)) return;
 
-    CcPixel *data = dst->data;
-
-    for (int y = 0; y < to_fill.h; ++y)
-    {
-        for (int x = 0; x < to_fill.w; ++x)
-        {
-            size_t dst_index = (to_fill.x + x) + (to_fill.y + y) * dst->w;
-            data[dst_index] = color;
-        }
-    }
+    fill_(cc_bitmap_bytes_at(dst, to_fill.x, to_fill.y), to_fill.w, to_fill.h, dst->stride, color);
 }
 
 void cc_bitmap_stroke_ellipse(CcBitmap* dst, int x0, int y0, int x1, int y1, CcPixel color)
@@ -549,8 +656,6 @@ void cc_bitmap_fill_ellipse(CcBitmap* dst, int x1, int y1, int x2, int y2, CcPix
 
     if (!cc_rect_intersect(rect, cc_bitmap_rect(dst), &rect)) return;
 
-    CcPixel *data = dst->data;
-
     for (int row = 0; row < rect.h; ++row)
     {
         double ey = (double)(rect.y + row) + 0.5 - cy;
@@ -569,9 +674,9 @@ void cc_bitmap_fill_ellipse(CcBitmap* dst, int x1, int y1, int x2, int y2, CcPix
             int startx = interval_clamp(cx - l, rect.x, rect.x + rect.w);
             int endx = interval_clamp(cx + l2, rect.x, rect.x + rect.w);
 
-            int y = row + rect.y; 
+            CcPixel *data = cc_bitmap_row(dst, row + rect.y);
             for (int x = startx; x < endx; ++x)
-                data[x + y * dst->w] = color;
+                data[x] = color;
         }
     }
 }
@@ -584,16 +689,43 @@ void cc_bitmap_stroke_rect(CcBitmap* b, int x1, int y1, int x2, int y2, int widt
     cc_bitmap_interp_square(b, x1, y2, x1, y1, width, color);
 }
 
-CcRect cc_bitmap_flood_fill(CcBitmap* b, int sx, int sy, CcPixel new_color)
+typedef struct
+{
+    // run [x1, x2] of row y is filled, row y + dy still needs a look.
+    int x1;
+    int x2;
+    int y;
+    int dy;
+} FillSpan;
+
+typedef struct
 {
-    /* stack safe verison of:
-    cc_bitmap_flood_fill_r(b, x - 1, y, old_color, new_color);
-    cc_bitmap_flood_fill_r(b, x + 1, y, old_color, new_color);
-    cc_bitmap_flood_fill_r(b, x, y - 1, old_color, new_color);
-    cc_bitmap_flood_fill_r(b, x, y + 1, old_color, new_color);
-    */
+    size_t count;
+    size_t capacity;
+    FillSpan* spans;
+} FillStack;
 
-    CcPixel *data = b->data;
+static
+void fill_push_(FillStack* stack, int x1, int x2, int y, int dy, int h)
+{
+    if (y + dy < 0 || y + dy >= h) return;
+
+    if (stack->count == stack->capacity)
+    {
+        stack->capacity = MAX(64, stack->capacity * 2);
+        stack->spans = realloc(stack->spans, sizeof(FillSpan) * stack->capacity);
+    }
+
+    FillSpan span = { x1, x2, y, dy };
+    stack->spans[stack->count++] = span;
+}
+
+CcRect cc_bitmap_flood_fill(CcBitmap* b, int sx, int sy, CcPixel new_color)
+{
+    // Scanline fill (Heckbert, Graphics Gems I).
+    // Whole runs of old_color are filled at once
+    // and the stack only holds runs whose neighbors are unchecked,
+    // so memory follows the shape of the region, not the size of the canvas.
     int W = b->w;
     int H = b->h;
 
@@ -602,189 +734,372 @@ CcRect cc_bitmap_flood_fill(CcBitmap* b, int sx, int sy, CcPixel new_color)
         return (CcRect) { 0, 0, 0, 0 };
     }
 
-    CcPixel old_color = data[sx + sy * W];
+    CcPixel *row = cc_bitmap_row(b, sy);
+    CcPixel old_color = row[sx];
     if (old_color == new_color)
     {
         return (CcRect) { 0, 0, 0, 0 };
     }
 
-    data[sx + sy * W] = new_color;
-
-    // every pixel will be visited at most once
-    CcCoord* queue = malloc(sizeof(CcCoord) * W * H);
-    CcCoord* front = queue;
-    CcCoord* back = front;
-
-    back->x = sx;
-    back->y = sy;    
-    ++back;
-
     int min_x = sx;
     int max_x = sx;
-
     int min_y = sy;
     int max_y = sy;
 
-    while (front != back)
-    {
-        int x = front->x;
-        int y = front->y;
+    // fill the seed run, then look both ways from it.
+    int l = sx;
+    int r = sx;
+    while (l > 0 && row[l - 1] == old_color) --l;
+    while (r + 1 < W && row[r + 1] == old_color) ++r;
+    fill_((char *)(row + l), r - l + 1, 1, 0, new_color);
 
-        int loc = x + y * W;
+    extend_interval(l, &min_x, &max_x);
+    extend_interval(r, &min_x, &max_x);
 
-        extend_interval(x, &min_x, &max_x);
-        extend_interval(y, &min_y, &max_y);
+    FillStack stack = { 0 };
+    fill_push_(&stack, l, r, sy, 1, H);
+    fill_push_(&stack, l, r, sy, -1, H);
 
-        if (0 <= x - 1 && data[loc - 1] == old_color)
-        {
-            // immediately indicate that this pixel has been visited, to avoid double counting.
-            data[loc - 1] = new_color;
-            back->x = x - 1;
-            back->y = y;
-            ++back;
-        }
+    while (stack.count > 0)
+    {
+        FillSpan span = stack.spans[--stack.count];
+        int y = span.y + span.dy;
+        row = cc_bitmap_row(b, y);
 
-        if (x + 1 < W && data[loc + 1] == old_color)
+        int x = span.x1;
+        while (x <= span.x2)
         {
-            data[loc + 1] = new_color;
-            back->x = x + 1;
-            back->y = y;
-            ++back;
+            if (row[x] != old_color)
+            {
+                ++x;
+                continue;
+            }
+
+            // only the first run can leak past the left end
+            l = x;
+            if (x == span.x1)
+            {
+                while (l > 0 && row[l - 1] == old_color) --l;
+            }
+
+            r = x;
+            while (r + 1 < W && row[r + 1] == old_color) ++r;
+
+            fill_((char *)(row + l), r - l + 1, 1, 0, new_color);
+
+            extend_interval(l, &min_x, &max_x);
+            extend_interval(r, &min_x, &max_x);
+            extend_interval(y, &min_y, &max_y);
+
+            fill_push_(&stack, l, r, y, span.dy, H);
+
+            // the row we came from was only checked above [x1, x2]
+            if (l < span.x1) fill_push_(&stack, l, span.x1 - 1, y, -span.dy, H);
+            if (r > span.x2) fill_push_(&stack, span.x2 + 1, r, y, -span.dy, H);
+
+            // r + 1 is a boundary
+            x = r + 2;
         }
+    }
+
+    free(stack.spans);
 
-        if (0 <= y - 1 && data[loc - W] == old_color)
+    return cc_rect_from_extrema(min_x, min_y, max_x, max_y);
+}
+
+void cc_bitmap_invert_colors(CcBitmap* b)
+{
+    for (int y = 0; y < b->h; ++y)
+    {
+        CcPixel *data = cc_bitmap_row(b, y);
+        for (int x = 0; x < b->w; ++x)
         {
-            data[loc - W] = new_color;
-            back->x = x;
-            back->y = y - 1;
-            ++back;
+            data[x] = cc_color_blend_invert(COLOR_WHITE, data[x]);
         }
+    }
+}
+
+// Rotation reads rows and writes columns (or the other way).
+// Working in small square tiles keeps both sides in cache.
+#define ROTATE_TILE 32
 
-        if (y + 1 < H && data[loc + W] == old_color)
+static inline
+void rotate_pixels_(const CcBitmap* src, CcBitmap* dst, int turns, int x0, int y0, int x1, int y1)
+{
+    for (int y = y0; y < y1; ++y)
+    {
+        const CcPixel *in = cc_bitmap_row(src, y);
+        for (int x = x0; x < x1; ++x)
         {
-            data[loc + W] = new_color;
-            back->x = x;
-            back->y = y + 1;
-            ++back;
+            if (turns == 1)
+                cc_bitmap_row(dst, x)[src->h - (y + 1)] = in[x];
+            else
+                cc_bitmap_row(dst, src->w - (x + 1))[y] = in[x];
         }
+    }
+}
 
-        ++front;
+#if defined(__SSE2__)
+// 4x4 block at (x, y) through a register transpose.
+static inline
+void rotate_block_(const CcBitmap* src, CcBitmap* dst, int turns, int x, int y)
+{
+    __m128i r[4];
+    for (int i = 0; i < 4; ++i)
+    {
+        // clockwise reads the rows bottom up
+        int row = turns == 1 ? y + 3 - i : y + i;
+        r[i] = _mm_loadu_si128((const __m128i *)(cc_bitmap_row(src, row) + x));
     }
 
-    free(queue);
+    __m128i t0 = _mm_unpacklo_epi32(r[0], r[1]);
+    __m128i t1 = _mm_unpacklo_epi32(r[2], r[3]);
+    __m128i t2 = _mm_unpackhi_epi32(r[0], r[1]);
+    __m128i t3 = _mm_unpackhi_epi32(r[2], r[3]);
 
-    return cc_rect_from_extrema(min_x, min_y, max_x, max_y);
+    __m128i c[4] = {
+        _mm_unpacklo_epi64(t0, t1),
+        _mm_unpackhi_epi64(t0, t1),
+        _mm_unpacklo_epi64(t2, t3),
+        _mm_unpackhi_epi64(t2, t3)
+    };
+
+    for (int j = 0; j < 4; ++j)
+    {
+        CcPixel *out;
+        if (turns == 1)
+            out = cc_bitmap_row(dst, x + j) + src->h - (y + 4);
+        else
+            out = cc_bitmap_row(dst, src->w - (x + j + 1)) + y;
+
+        _mm_storeu_si128((__m128i *)out, c[j]);
+    }
 }
+#endif
 
-void cc_bitmap_invert_colors(CcBitmap* b)
+void cc_bitmap_rotate_90(const CcBitmap* src, CcBitmap* dst, int turns)
 {
-    CcPixel *data = b->data;
+    turns = ((turns % 4) + 4) % 4;
 
-    size_t N = b->w * b->h;
+    if (turns % 2 == 0)
+    {
+        cc_bitmap_copy(src, dst);
+        if (turns == 2) cc_bitmap_rotate_180(dst);
+        return;
+    }
 
-    for (size_t i = 0; i < N; ++i)
+    assert(dst->w == src->h && dst->h == src->w);
+
+    for (int ty = 0; ty < src->h; ty += ROTATE_TILE)
     {
-        data[i] = cc_color_blend_invert(COLOR_WHITE, data[i]);
+        int ey = MIN(ty + ROTATE_TILE, src->h);
+
+        for (int tx = 0; tx < src->w; tx += ROTATE_TILE)
+        {
+            int ex = MIN(tx + ROTATE_TILE, src->w);
+            int y = ty;
+#if defined(__SSE2__)
+            for (; y + 4 <= ey; y += 4)
+            {
+                int x = tx;
+                for (; x + 4 <= ex; x += 4)
+                    rotate_block_(src, dst, turns, x, y);
+
+                rotate_pixels_(src, dst, turns, x, y, ex, y + 4);
+            }
+#endif
+            rotate_pixels_(src, dst, turns, tx, y, ex, ey);
+        }
     }
 }
 
-void cc_bitmap_rotate_90(const CcBitmap* src, CcBitmap* dst)
+// swap a[i] with b[n - 1 - i] for i in [0, count).
+// a and b may be the same row, then count should be n / 2.
+static
+void reverse_swap_(CcPixel* a, CcPixel* b, int n, int count)
 {
-    for (int y = 0; y < src->h; ++y)
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)
     {
-        for (int x = 0; x < src->w; ++x)
-        {
-            dst->data[(src->h - (y + 1)) + x * src->h] = src->data[x + y * src->w];
-        }
+        __m128i *left = (__m128i *)(a + i);
+        __m128i *right = (__m128i *)(b + n - (i + 4));
+
+        __m128i l = _mm_loadu_si128(left);
+        __m128i r = _mm_loadu_si128(right);
+        _mm_storeu_si128(left, _mm_shuffle_epi32(r, _MM_SHUFFLE(0, 1, 2, 3)));
+        _mm_storeu_si128(right, _mm_shuffle_epi32(l, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        SWAP(a[i], b[n - (i + 1)], CcPixel);
     }
 }
 
-void cc_bitmap_flip_horiz(const CcBitmap* src, CcBitmap* dst)
+void cc_bitmap_rotate_180(CcBitmap* b)
 {
-    const CcPixel * restrict in = src->data;
-    CcPixel * restrict out = dst->data;
+    for (int y = 0; y < b->h / 2; ++y)
+    {
+        reverse_swap_(cc_bitmap_row(b, y), cc_bitmap_row(b, b->h - (y + 1)), b->w, b->w);
+    }
 
-    for (int y = 0; y < src->h; ++y)
+    if (b->h % 2 == 1)
     {
-        for (int x = 0; x < src->w; ++x)
-        {
-            int flip_x = src->w - (x + 1);
-            out[flip_x + y * src->w] = in[x + y * src->w];
-        }
+        CcPixel *middle = cc_bitmap_row(b, b->h / 2);
+        reverse_swap_(middle, middle, b->w, b->w / 2);
     }
 }
 
-void cc_bitmap_flip_vert(const CcBitmap* src, CcBitmap* dst)
+void cc_bitmap_flip_horiz(CcBitmap* b)
 {
-    const CcPixel * restrict in = src->data;
-    CcPixel * restrict out = dst->data;
+    for (int y = 0; y < b->h; ++y)
+    {
+        CcPixel *row = cc_bitmap_row(b, y);
+        reverse_swap_(row, row, b->w, b->w / 2);
+    }
+}
 
-    for (int y = 0; y < src->h; ++y)
+void cc_bitmap_flip_vert(CcBitmap* b)
+{
+    // rows only change places, so they are swapped with memcpy
+    // a piece at a time, through a buffer that stays in cache.
+    CcPixel temp[256];
+    for (int y = 0; y < b->h / 2; ++y)
     {
-        for (int x = 0; x < src->w; ++x)
+        CcPixel * restrict top = cc_bitmap_row(b, y);
+        CcPixel * restrict bottom = cc_bitmap_row(b, b->h - (y + 1));
+
+        for (int x = 0; x < b->w; x += 256)
         {
-            int flip_y = src->h - (y + 1);
-            out[x + flip_y * src->w] = in[x + y * src->w];
+            size_t size = sizeof(CcPixel) * MIN(256, b->w - x);
+            memcpy(temp, top + x, size);
+            memcpy(top + x, bottom + x, size);
+            memcpy(bottom + x, temp, size);
         }
     }
 }
 
-void cc_bitmap_zoom(const CcBitmap* src, CcBitmap* dst, int zoom)
+void cc_bitmap_filter(CcBitmap* b, CcRowFilter filter)
 {
-    // we have enough src material
-    assert(dst->w <= src->w * zoom);
-    assert(dst->h <= src->h * zoom);
-    assert(src != dst);
-
-    int x = 1;
-    int i;
-    for (i = 0; i < 16; ++i)
+    for (int y = 0; y < b->h; ++y)
     {
-        if (x == zoom) break;
-        x *= 2;
+        filter(cc_bitmap_row(b, y), b->w);
     }
+}
+
+// repeat each pixel of src zoom times, until n pixels of dst are written.
+static
+void zoom_row_(const CcPixel* restrict src, CcPixel* restrict dst, int n, int zoom)
+{
+    int blocks = n / zoom;
+    int x = 0;
 
-    if (i == 16)
+    if (zoom == 2)
     {
-        cc_bitmap_zoom_general(src, dst, zoom);
+        for (int i = 0; i < blocks; ++i, x += 2)
+        {
+            dst[x] = src[i];
+            dst[x + 1] = src[i];
+        }
     }
     else
     {
-        cc_bitmap_zoom_power_of_2(src, dst, i);
+        for (int i = 0; i < blocks; ++i, x += zoom)
+        {
+            int k = 0;
+#if defined(__SSE2__)
+            __m128i p = _mm_set1_epi32((int)src[i]);
+            for (; k + 4 <= zoom; k += 4)
+                _mm_storeu_si128((__m128i *)(dst + x + k), p);
+#endif
+            for (; k < zoom; ++k)
+                dst[x + k] = src[i];
+        }
     }
+
+    // partial block on the right edge
+    for (; x < n; ++x)
+        dst[x] = src[blocks];
 }
 
-void cc_bitmap_zoom_general(const CcBitmap* src, CcBitmap* dst, int zoom)
+void cc_bitmap_zoom(const CcBitmap* src, CcBitmap* dst, int zoom, CcRowFilter filter)
 {
-    const CcPixel * restrict in = src->data;
-    CcPixel * restrict out = dst->data;
+    // we have enough src material
+    assert(dst->w <= src->w * zoom);
+    assert(dst->h <= src->h * zoom);
+    assert(src != dst);
+    assert(zoom > 0);
 
-    for (int y = 0; y < dst->h; ++y)
+    // every row in a block of zoom rows is the same.
+    // expand (and filter) the first one, then copy it down.
+    for (int y = 0; y < dst->h; y += zoom)
     {
-        for (int x = 0; x < dst->w; ++x)
+        CcPixel *first = cc_bitmap_row(dst, y);
+        zoom_row_(cc_bitmap_row(src, y / zoom), first, dst->w, zoom);
+
+        if (filter) filter(first, dst->w);
+
+        int end = MIN(y + zoom, dst->h);
+        for (int row = y + 1; row < end; ++row)
         {
-            int src_x = x / zoom;
-            int src_y = y / zoom;
-            *out = in[src_x + src_y * src->w];
-            ++out;
+            memcpy(cc_bitmap_row(dst, row), first, dst->w * sizeof(CcPixel));
         }
     }
 }
 
-void cc_bitmap_zoom_power_of_2(const CcBitmap* src, CcBitmap* dst, int zoom_power)
+
+static inline
+CcPixel average4_(CcPixel p0, CcPixel p1, CcPixel p2, CcPixel p3)
 {
-    const CcPixel *restrict in = src->data;
-    CcPixel *restrict out = dst->data;
+    if ((p0 & p1 & p2 & p3) >= COLOR_ALPHA_MASK)
+    {
+        // opaque: red and blue, then alpha and green, two lanes at a time.
+        uint32_t rb = (p0 & 0x00FF00FF) + (p1 & 0x00FF00FF) + (p2 & 0x00FF00FF) + (p3 & 0x00FF00FF);
+        uint32_t ag = ((p0 >> 8) & 0x00FF00FF) + ((p1 >> 8) & 0x00FF00FF)
+            + ((p2 >> 8) & 0x00FF00FF) + ((p3 >> 8) & 0x00FF00FF);
+        rb = ((rb + 0x00020002) >> 2) & 0x00FF00FF;
+        ag = ((ag + 0x00020002) >> 2) & 0x00FF00FF;
+        return rb | (ag << 8);
+    }
 
-    for (int y = 0; y < dst->h; ++y)
+    CcPixel p[4] = { p0, p1, p2, p3 };
+    uint32_t alpha = 0;
+    uint32_t sums[3] = { 0 };
+    for (int i = 0; i < 4; ++i)
     {
-        for (int x = 0; x < dst->w; ++x)
+        uint32_t a = p[i] >> COLOR_ALPHA_SHIFT;
+        alpha += a;
+        sums[0] += a * ((p[i] >> 16) & 0xFF);
+        sums[1] += a * ((p[i] >> 8) & 0xFF);
+        sums[2] += a * (p[i] & 0xFF);
+    }
+    if (alpha == 0) return COLOR_CLEAR;
+
+    CcPixel out = ((alpha + 2) >> 2) << COLOR_ALPHA_SHIFT;
+    out |= ((sums[0] + alpha / 2) / alpha) << 16;
+    out |= ((sums[1] + alpha / 2) / alpha) << 8;
+    out |= (sums[2] + alpha / 2) / alpha;
+    return out;
+}
+
+void cc_bitmap_halve(const CcBitmap* src, CcBitmap* dst, CcRect r)
+{
+    assert(dst->w == int_ceil(src->w, 2));
+    assert(dst->h == int_ceil(src->h, 2));
+    if (!cc_rect_intersect(r, cc_bitmap_rect(dst), &r)) return;
+
+    for (int y = r.y; y < r.y + r.h; ++y)
+    {
+        const CcPixel* a = cc_bitmap_row(src, 2 * y);
+        const CcPixel* b = cc_bitmap_row(src, MIN(2 * y + 1, src->h - 1));
+        CcPixel* out = cc_bitmap_row(dst, y);
+
+        for (int x = r.x; x < r.x + r.w; ++x)
         {
-            int src_x = x >> zoom_power;
-            int src_y = y >> zoom_power;
-            *out = in[src_x + src_y * src->w];
-            ++out;
+            int x0 = 2 * x;
+            int x1 = MIN(x0 + 1, src->w - 1);
+            out[x] = average4_(a[x0], a[x1], b[x0], b[x1]);
         }
     }
 }
-
@@ -45,6 +45,9 @@ typedef struct
 {
     int w;
     int h;
+    // bytes from one row to the next.
+    // at least w * sizeof(CcPixel), more for views.
+    uint32_t stride;
     CcPixel* data;
 } CcBitmap;
 
@@ -61,34 +64,82 @@ CcRect cc_bitmap_rect(const CcBitmap* b)
 static inline
 char *cc_bitmap_bytes_at(const CcBitmap *b, int x, int y)
 {
-    return (char *)(b->data + b->w * y + x);
+    return (char *)b->data + (size_t)b->stride * y + sizeof(CcPixel) * x;
+}
+
+static inline
+CcPixel *cc_bitmap_row(const CcBitmap *b, int y)
+{
+    return (CcPixel *)((char *)b->data + (size_t)b->stride * y);
+}
+
+// rows follow each other with no gaps
+static inline
+int cc_bitmap_is_packed(const CcBitmap *b)
+{
+    return b->stride == b->w * sizeof(CcPixel);
+}
+
+// A view is a bitmap which shares pixels with the bitmap it was made from.
+// Reading and writing to it is the same as the region of the original.
+// It does not own its data, so never free it or hand it to a layer.
+//
+// requires: r is contained in b.
+static inline
+CcBitmap cc_bitmap_view(const CcBitmap *b, CcRect r)
+{
+    assert(r.x >= 0 && r.y >= 0);
+    assert(r.x + r.w <= b->w && r.y + r.h <= b->h);
+
+    CcBitmap view = {
+        .w = r.w,
+        .h = r.h,
+        .stride = b->stride,
+        .data = (CcPixel *)cc_bitmap_bytes_at(b, r.x, r.y)
+    };
+    return view;
 }
 
 static inline
 CcPixel cc_bitmap_get(const CcBitmap* b, int x, int y, CcPixel bg_color)
 {
     if (!cc_rect_contains(cc_bitmap_rect(b), x, y)) return bg_color;
-    return b->data[x + y * b->w];
+    return cc_bitmap_row(b, y)[x];
 }
 
 static inline
 void cc_bitmap_set(CcBitmap* b, int x, int y, CcPixel color)
 {
     if (!cc_rect_contains(cc_bitmap_rect(b), x, y)) return;
-    b->data[x + y * b->w] = color;
+    cc_bitmap_row(b, y)[x] = color;
 }
 
 void cc_bitmap_clear(CcBitmap* b, CcPixel color);
 
+// allocates a packed bitmap of size w, h.
 void cc_bitmap_alloc(CcBitmap* b);
 void cc_bitmap_free(CcBitmap* b);
 void cc_bitmap_copy(const CcBitmap *src, CcBitmap *dst);
+// moves the pixel at (x + dx, y + dy) to (x, y).
+// what is uncovered keeps whatever it had.
+void cc_bitmap_shift(CcBitmap* b, int dx, int dy);
 
 // a mask is a 1 channel (8 bit) alpha image.
 void cc_bitmap_copy_channel(CcBitmap* b, size_t channel_index, const CcGrayBitmap *channel);
 
 void cc_bitmap_replace(CcBitmap* b, CcPixel old_color, CcPixel new_color);
 
+typedef enum
+{
+    // every alpha is 0
+    COVERAGE_CLEAR = 1,
+    // every alpha is 255
+    COVERAGE_OPAQUE,
+    COVERAGE_MIXED,
+} CcCoverage;
+
+CcCoverage cc_bitmap_coverage(const CcBitmap* b);
+
 void cc_bitmap_swap_channels(CcBitmap *b);
 
 // requires:
@@ -119,7 +170,7 @@ void cc_bitmap_blit_unsafe(
         CcColorBlend blend
         );
 
-void cc_bitmap_draw_spray(CcBitmap* b, int cx, int cy, int r, int density, CcPixel color);
+void cc_bitmap_draw_spray(CcBitmap* b, int cx, int cy, int r, int density, CcPixel color, CcRandom* random);
 
 void cc_bitmap_draw_circle(CcBitmap* b, int cx, int cy, int r, CcPixel color);
 void cc_bitmap_draw_square(CcBitmap* b, int cx, int cy, int d, CcPixel color);
@@ -137,15 +188,29 @@ void cc_bitmap_fill_ellipse(CcBitmap* dst, int x1, int y1, int x2, int y2, CcPix
 
 void cc_bitmap_invert_colors(CcBitmap* bitmap);
 
-void cc_bitmap_rotate_90(const CcBitmap* src, CcBitmap* dst);
-void cc_bitmap_flip_horiz(const CcBitmap* src, CcBitmap* dst);
-void cc_bitmap_flip_vert(const CcBitmap* src, CcBitmap* dst);
+// rotates clockwise by turns * 90 degrees.
+// requires: dst is src transposed for odd turns, the same size for even. src and dst don't overlap.
+void cc_bitmap_rotate_90(const CcBitmap* src, CcBitmap* dst, int turns);
+
+// in place
+void cc_bitmap_rotate_180(CcBitmap* b);
+void cc_bitmap_flip_horiz(CcBitmap* b);
+void cc_bitmap_flip_vert(CcBitmap* b);
+
+// Converts n pixels in place, for example into the display's format.
+typedef void (*CcRowFilter)(CcPixel* row, int n);
 
+void cc_bitmap_filter(CcBitmap* b, CcRowFilter filter);
+
+// filter (may be NULL) is applied to the zoomed pixels, in the same pass.
 // requires: 
 //  src and dst are not the same bitmap
-void cc_bitmap_zoom(const CcBitmap* src, CcBitmap* dst, int zoom);
-void cc_bitmap_zoom_general(const CcBitmap* src, CcBitmap* dst, int zoom);
-void cc_bitmap_zoom_power_of_2(const CcBitmap* src, CcBitmap* dst, int zoom_power);
+void cc_bitmap_zoom(const CcBitmap* src, CcBitmap* dst, int zoom, CcRowFilter filter);
+
+// Averages each 2x2 square of src into one pixel of dst, for the part r of dst.
+// dst is int_ceil(src->w, 2) by int_ceil(src->h, 2), odd edges repeat the last pixel.
+// Colors are weighted by alpha, so clear pixels don't bleed into the rest.
+void cc_bitmap_halve(const CcBitmap* src, CcBitmap* dst, CcRect r);
 
 CcRect cc_bitmap_flood_fill(CcBitmap* b, int sx, int sy, CcPixel new_color);
 
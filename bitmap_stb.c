@@ -37,6 +37,7 @@ CcBitmap cc_bitmap_decompress(unsigned char* compressed_data, size_t compressed_
     CcBitmap b = {
         .w = w,
         .h = h,
+        .stride = w * sizeof(CcPixel),
         .data = (CcPixel *)data
     };
     return b;
@@ -48,9 +49,8 @@ unsigned char* cc_bitmap_compress(const CcBitmap* b, size_t* out_size)
 
     CompressContext ctx = { 0 };
 
-    size_t stride = b->w * sizeof(CcPixel);
     stbi_write_png_compression_level = 5;
-    if (stbi_write_png_to_func(write_, &ctx, b->w, b->h, 4, b->data, stride))
+    if (stbi_write_png_to_func(write_, &ctx, b->w, b->h, 4, b->data, b->stride))
     {
         if (ctx.capacity > ctx.size)
         {
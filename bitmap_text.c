@@ -262,7 +262,7 @@ void render_(
                 assert(c_y2 - c_y1 <= glyph_map.w);
                 assert(c_x2 - c_x1 <= glyph_map.h);
 
-                cc_bitmap_copy_channel(&glyph_map, 0, &glyph_mask);
+                cc_bitmap_copy_channel(&glyph_map, COLOR_ALPHA_BYTE, &glyph_mask);
                 cc_bitmap_blit(
                         &glyph_map,
                         bitmap,
@@ -15,59 +15,236 @@
  */
 
 #include "bitmap.h"
+#include "ui.h"
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static
+void mask_to_shift_(unsigned long mask, int* shift, int* bits)
+{
+    *shift = 0;
+    *bits = 0;
+    if (!mask) return;
+
+    while (!(mask & 1)) { mask >>= 1; ++*shift; }
+    while (mask & 1) { mask >>= 1; ++*bits; }
+}
+
+int cc_xformat_init(CcXFormat* format, const XVisualInfo* info, int bits_per_pixel)
+{
+    if (bits_per_pixel != 16 && bits_per_pixel != 32) return 0;
+
+    format->bytes_per_pixel = bits_per_pixel / 8;
+
+    unsigned long masks[3] = { info->red_mask, info->green_mask, info->blue_mask };
+    format->dither = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        mask_to_shift_(masks[i], format->shift + i, format->bits + i);
+        if (format->bits[i] < 1 || format->bits[i] > 16) return 0;
+        if (format->shift[i] + format->bits[i] > bits_per_pixel) return 0;
+
+        // low depth visuals band smooth gradients without it
+        if (format->bits[i] < 8) format->dither = 1;
+    }
+    return 1;
+}
+
+// ordered dithering, 4x4 Bayer matrix
+static
+const int bayer_[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 },
+};
+
+// Each 8 bit channel c is repeated (c * 257) and the top bits taken.
+// That truncates for fewer than 8 bits and fills 10 bit channels evenly.
 static inline
-CcPixel swap1_pixel_(CcPixel x)
+uint32_t channel_(uint32_t c, int bits, int shift)
 {
-  return x >> 8;
-  //return cc_color_swap(x) >> 8;
-  /*
-    return ((x & 0xFF000000) >> 24) |
-        ((x & 0x00FF0000) >> 8)  |
-        ((x & 0x0000FF00) << 8)  |
-        ((x & 0x000000FF) << 24);
-        */
+    return ((c * 257) >> (16 - bits)) << shift;
 }
 
 static inline
-void swap1_(
-        char *dst,
-        size_t stride,
-        int w,
-        int h) {
+uint32_t convert_pixel_(CcPixel p, const CcXFormat* f, const int* dither)
+{
+    uint32_t out = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        uint32_t c = (p >> (16 - 8 * i)) & 0xFF;
+        c = MIN(c + dither[i], 255);
+        out |= channel_(c, f->bits[i], f->shift[i]);
+    }
+    return out;
+}
 
-    while (h)
+// dither added to each channel for pixel x of row y.
+static
+void dither_row_(const CcXFormat* f, int x, int y, int out[4][3])
+{
+    for (int k = 0; k < 4; ++k)
     {
+        for (int i = 0; i < 3; ++i)
+        {
+            int step = f->bits[i] < 8 ? 1 << (8 - f->bits[i]) : 0;
+            out[k][i] = f->dither ? (bayer_[y & 3][(x + k) & 3] * step) >> 4 : 0;
+        }
+    }
+}
 
-        CcPixel *row = (CcPixel *)dst;
-        for (int col = 0; col < w; ++col) {
-            row[col] = swap1_pixel_(row[col]);
+#if defined(__SSE2__)
+static inline
+__m128i convert4_(__m128i p, const CcXFormat* f, const __m128i* dither)
+{
+    __m128i out = _mm_setzero_si128();
+    __m128i byte = _mm_set1_epi32(0xFF);
+
+    for (int i = 0; i < 3; ++i)
+    {
+        __m128i c = _mm_and_si128(_mm_srli_epi32(p, 16 - 8 * i), byte);
+        if (f->dither)
+        {
+            c = _mm_add_epi32(c, dither[i]);
+            __m128i over = _mm_cmpgt_epi32(c, byte);
+            c = _mm_or_si128(_mm_andnot_si128(over, c), _mm_and_si128(over, byte));
         }
-        dst += stride;
-        --h;
+        c = _mm_or_si128(c, _mm_slli_epi32(c, 8));
+        c = _mm_srl_epi32(c, _mm_cvtsi32_si128(16 - f->bits[i]));
+        out = _mm_or_si128(out, _mm_sll_epi32(c, _mm_cvtsi32_si128(f->shift[i])));
     }
+    return out;
 }
 
-void cc_bitmap_swap_for_xvisual(CcBitmap *b, const XVisualInfo *info)
+static
+void load_dither_(int d[4][3], __m128i out[3])
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        out[i] = _mm_setr_epi32(d[0][i], d[1][i], d[2][i], d[3][i]);
+    }
+}
+#endif
+
+// 4 byte formats convert in place, but the filter has no room for the format.
+// There is only one display, so it lives here. Set once before any thread filters,
+// then only read.
+static
+CcXFormat filter_format_;
+
+static
+void convert32_(CcPixel *row, int n)
+{
+    const CcXFormat* f = &filter_format_;
+    int no_dither[3] = { 0 };
+    int col = 0;
+
+#if defined(__SSE2__)
+    for (; col + 4 <= n; col += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i *)(row + col));
+        _mm_storeu_si128((__m128i *)(row + col), convert4_(p, f, NULL));
+    }
+#endif
+    for (; col < n; ++col)
+    {
+        row[col] = convert_pixel_(row[col], f, no_dither);
+    }
+}
+
+static
+void swap_rb_(CcPixel *row, int n)
+{
+    // same shuffle as file codecs, the top byte is ignored by the display.
+    for (int col = 0; col < n; ++col)
+    {
+        row[col] = cc_color_swap(row[col]);
+    }
+}
+
+CcRowFilter cc_row_filter_for_xformat(const CcXFormat* format)
 {
     // https://groups.google.com/g/comp.windows.x/c/c4tjX7UiuVU
-    if (info->red_mask == 0x00FF0000
-         && info->green_mask == 0x0000FF00
-         && info->blue_mask == 0x000000FF) {
-        swap1_((char *)b->data, sizeof(CcPixel) * b->w, b->w, b->h);
-    } else {
-        assert(0); // need to change formats
+    assert(format->bytes_per_pixel == 4);
+
+    int bits_8 = format->bits[0] == 8 && format->bits[1] == 8 && format->bits[2] == 8;
+    if (bits_8 && format->shift[0] == 16 && format->shift[1] == 8 && format->shift[2] == 0)
+    {
+        // same layout as CcPixel, the unused top byte is ignored.
+        return NULL;
+    }
+    else if (bits_8 && format->shift[0] == 0 && format->shift[1] == 8 && format->shift[2] == 16)
+    {
+        return swap_rb_;
+    }
+    else
+    {
+        assert(filter_format_.bytes_per_pixel == 4);
+        assert(memcmp(filter_format_.shift, format->shift, sizeof(format->shift)) == 0);
+        assert(memcmp(filter_format_.bits, format->bits, sizeof(format->bits)) == 0);
+        return convert32_;
     }
 }
 
-XImage *cc_bitmap_create_ximage(CcBitmap *b, Display *display, Visual *visual)
+void cc_row_filter_set_xformat(const CcXFormat* format)
+{
+    filter_format_ = *format;
+    filter_format_.dither = 0;
+}
+
+void cc_bitmap_pack_ximage(const CcBitmap* src, XImage* dst, CcRect r, const CcXFormat* format)
+{
+    assert(format->bytes_per_pixel == 2);
+    assert(dst->bits_per_pixel == 16);
+
+    for (int y = r.y; y < r.y + r.h; ++y)
+    {
+        const CcPixel* in = cc_bitmap_row(src, y) + r.x;
+        uint16_t* out = (uint16_t *)(dst->data + (size_t)dst->bytes_per_line * y) + r.x;
+
+        // the pattern repeats every 4 pixels, so lanes keep their dither along the row.
+        int dither[4][3];
+        dither_row_(format, r.x, y, dither);
+
+        int col = 0;
+#if defined(__SSE2__)
+        __m128i d[3];
+        load_dither_(dither, d);
+        __m128i bias = _mm_set1_epi32(0x8000);
+        for (; col + 8 <= r.w; col += 8)
+        {
+            __m128i lo = convert4_(_mm_loadu_si128((const __m128i *)(in + col)), format, d);
+            __m128i hi = convert4_(_mm_loadu_si128((const __m128i *)(in + col + 4)), format, d);
+            // there is no unsigned pack in SSE2, shift into signed range and back.
+            __m128i packed = _mm_packs_epi32(_mm_sub_epi32(lo, bias), _mm_sub_epi32(hi, bias));
+            packed = _mm_add_epi16(packed, _mm_set1_epi16((short)0x8000));
+            _mm_storeu_si128((__m128i *)(out + col), packed);
+        }
+#endif
+        for (; col < r.w; ++col)
+        {
+            out[col] = (uint16_t)convert_pixel_(in[col], format, dither[col & 3]);
+        }
+    }
+}
+
+XImage *cc_create_ximage(Display *display, Visual *visual, int depth, const CcXFormat* format, int w, int h)
 {
     // What is bitmap_pad?
     // the documentation isn't clear, but I found:
     // "This is a very roundabout way of describing the pixel size in bits."
     // https://handmade.network/wiki/2834-tutorial_a_tour_through_xlib_and_related_technologies
-    return XCreateImage(display, visual, 24, ZPixmap, 0, (char *)b->data, b->w, b->h, 32, b->w * sizeof(CcPixel));
-}
+    int stride = w * format->bytes_per_pixel;
 
+    // rows of 16 bit images are padded to 4 bytes.
+    stride = (stride + 3) & ~3;
+
+    char* data = malloc((size_t)stride * h);
+    if (!data) return NULL;
+    return XCreateImage(display, visual, depth, ZPixmap, 0, data, w, h, 32, stride);
+}
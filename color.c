@@ -3,6 +3,265 @@
 #include <string.h>
 #include "color.h"
 
+// Vector versions of the blend functions.
+// Pixels are 0xRRGGBBAA, so in memory (little endian) alpha is the first byte.
+// Each step widens the bytes to 16 bit lanes, does the same fixed point math
+// as the scalar code, then narrows back.
+// All products of two bytes fit in an unsigned 16 bit lane, as does p + (p >> 7).
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+#define VEC_PIXELS 8
+typedef __m256i Vec;
+
+static inline Vec v_load_(const CcPixel *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void v_store_(CcPixel *p, Vec x) { _mm256_storeu_si256((__m256i *)p, x); }
+static inline Vec v_set16_(int16_t x) { return _mm256_set1_epi16(x); }
+static inline Vec v_set32_(int32_t x) { return _mm256_set1_epi32(x); }
+static inline Vec v_widen_lo_(Vec x) { return _mm256_unpacklo_epi8(x, _mm256_setzero_si256()); }
+static inline Vec v_widen_hi_(Vec x) { return _mm256_unpackhi_epi8(x, _mm256_setzero_si256()); }
+static inline Vec v_narrow_(Vec lo, Vec hi) { return _mm256_packus_epi16(lo, hi); }
+static inline Vec v_add16_(Vec a, Vec b) { return _mm256_add_epi16(a, b); }
+static inline Vec v_sub16_(Vec a, Vec b) { return _mm256_sub_epi16(a, b); }
+static inline Vec v_mul16_(Vec a, Vec b) { return _mm256_mullo_epi16(a, b); }
+static inline Vec v_shr16_(Vec a, int n) { return _mm256_srli_epi16(a, n); }
+static inline Vec v_and_(Vec a, Vec b) { return _mm256_and_si256(a, b); }
+static inline Vec v_andnot_(Vec a, Vec b) { return _mm256_andnot_si256(a, b); }
+static inline Vec v_or_(Vec a, Vec b) { return _mm256_or_si256(a, b); }
+static inline Vec v_eq32_(Vec a, Vec b) { return _mm256_cmpeq_epi32(a, b); }
+static inline Vec v_alpha_(Vec x) { return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, 0xFF), 0xFF); }
+static inline Vec v_shl32_(Vec a, int n) { return _mm256_slli_epi32(a, n); }
+static inline Vec v_shr32_(Vec a, int n) { return _mm256_srli_epi32(a, n); }
+static inline int v_is_zero_(Vec x) { return _mm256_testz_si256(x, x); }
+
+typedef __m256 VecF;
+
+static inline VecF v_float_(Vec x) { return _mm256_cvtepi32_ps(x); }
+static inline Vec v_int_(VecF x) { return _mm256_cvttps_epi32(x); }
+static inline VecF v_fset_(float x) { return _mm256_set1_ps(x); }
+static inline VecF v_fadd_(VecF a, VecF b) { return _mm256_add_ps(a, b); }
+static inline VecF v_fsub_(VecF a, VecF b) { return _mm256_sub_ps(a, b); }
+static inline VecF v_fmul_(VecF a, VecF b) { return _mm256_mul_ps(a, b); }
+static inline VecF v_fdiv_(VecF a, VecF b) { return _mm256_div_ps(a, b); }
+static inline VecF v_fmax_(VecF a, VecF b) { return _mm256_max_ps(a, b); }
+static inline VecF v_fand_(VecF a, VecF b) { return _mm256_and_ps(a, b); }
+static inline VecF v_fgt_(VecF a, VecF b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline VecF v_fle_(VecF a, VecF b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+#define VEC_PIXELS 4
+typedef __m128i Vec;
+
+static inline Vec v_load_(const CcPixel *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void v_store_(CcPixel *p, Vec x) { _mm_storeu_si128((__m128i *)p, x); }
+static inline Vec v_set16_(int16_t x) { return _mm_set1_epi16(x); }
+static inline Vec v_set32_(int32_t x) { return _mm_set1_epi32(x); }
+static inline Vec v_widen_lo_(Vec x) { return _mm_unpacklo_epi8(x, _mm_setzero_si128()); }
+static inline Vec v_widen_hi_(Vec x) { return _mm_unpackhi_epi8(x, _mm_setzero_si128()); }
+static inline Vec v_narrow_(Vec lo, Vec hi) { return _mm_packus_epi16(lo, hi); }
+static inline Vec v_add16_(Vec a, Vec b) { return _mm_add_epi16(a, b); }
+static inline Vec v_sub16_(Vec a, Vec b) { return _mm_sub_epi16(a, b); }
+static inline Vec v_mul16_(Vec a, Vec b) { return _mm_mullo_epi16(a, b); }
+static inline Vec v_shr16_(Vec a, int n) { return _mm_srli_epi16(a, n); }
+static inline Vec v_and_(Vec a, Vec b) { return _mm_and_si128(a, b); }
+static inline Vec v_andnot_(Vec a, Vec b) { return _mm_andnot_si128(a, b); }
+static inline Vec v_or_(Vec a, Vec b) { return _mm_or_si128(a, b); }
+static inline Vec v_eq32_(Vec a, Vec b) { return _mm_cmpeq_epi32(a, b); }
+static inline Vec v_alpha_(Vec x) { return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xFF), 0xFF); }
+static inline Vec v_shl32_(Vec a, int n) { return _mm_slli_epi32(a, n); }
+static inline Vec v_shr32_(Vec a, int n) { return _mm_srli_epi32(a, n); }
+static inline int v_is_zero_(Vec x) { return _mm_movemask_epi8(_mm_cmpeq_epi32(x, _mm_setzero_si128())) == 0xFFFF; }
+
+typedef __m128 VecF;
+
+static inline VecF v_float_(Vec x) { return _mm_cvtepi32_ps(x); }
+static inline Vec v_int_(VecF x) { return _mm_cvttps_epi32(x); }
+static inline VecF v_fset_(float x) { return _mm_set1_ps(x); }
+static inline VecF v_fadd_(VecF a, VecF b) { return _mm_add_ps(a, b); }
+static inline VecF v_fsub_(VecF a, VecF b) { return _mm_sub_ps(a, b); }
+static inline VecF v_fmul_(VecF a, VecF b) { return _mm_mul_ps(a, b); }
+static inline VecF v_fdiv_(VecF a, VecF b) { return _mm_div_ps(a, b); }
+static inline VecF v_fmax_(VecF a, VecF b) { return _mm_max_ps(a, b); }
+static inline VecF v_fand_(VecF a, VecF b) { return _mm_and_ps(a, b); }
+static inline VecF v_fgt_(VecF a, VecF b) { return _mm_cmpgt_ps(a, b); }
+static inline VecF v_fle_(VecF a, VecF b) { return _mm_cmple_ps(a, b); }
+
+#endif
+
+#ifdef VEC_PIXELS
+
+// same as fixed_mul_255 on each lane
+static inline
+Vec v_mul_255_(Vec x, Vec y)
+{
+    Vec p = v_mul16_(x, y);
+    return v_shr16_(v_add16_(p, v_shr16_(p, 7)), 8);
+}
+
+static inline
+Vec v_overlay_(Vec s, Vec d)
+{
+    Vec a = v_alpha_(s);
+    Vec inv_a = v_sub16_(v_set16_(255), a);
+    return v_add16_(v_mul_255_(inv_a, d), v_mul_255_(s, a));
+}
+
+static inline
+Vec v_invert_(Vec s, Vec d)
+{
+    Vec a = v_alpha_(s);
+    Vec twice = v_mul_255_(d, a);
+    twice = v_add16_(twice, twice);
+    // the scalar version truncates to a byte
+    return v_and_(v_sub16_(v_add16_(d, a), twice), v_set16_(0xFF));
+}
+
+static inline
+VecF v_trunc_(VecF x)
+{
+    return v_float_(v_int_(x));
+}
+
+// Exact round(n / d) for integers n < 2^24 and 0 < d < 2^16 held in floats.
+// The quotient from the reciprocal is off by at most one.
+// The products used to correct it are integers below 2^24, so are exact.
+static inline
+VecF v_div_round_(VecF n, VecF d)
+{
+    VecF one = v_fset_(1.0f);
+    VecF q = v_trunc_(v_fadd_(v_fmul_(n, v_fdiv_(one, d)), v_fset_(0.5f)));
+
+    // want: q d <= n + floor(d / 2) < (q + 1) d
+    VecF limit = v_fadd_(n, v_trunc_(v_fmul_(d, v_fset_(0.5f))));
+    q = v_fsub_(q, v_fand_(v_fgt_(v_fmul_(q, d), limit), one));
+    q = v_fadd_(q, v_fand_(v_fle_(v_fmul_(v_fadd_(q, one), d), limit), one));
+    return q;
+}
+
+static inline
+VecF v_channel_(Vec x, int shift)
+{
+    return v_float_(v_and_(v_shr32_(x, shift), v_set32_(0xFF)));
+}
+
+// Same math as cc_color_blend_full2, one pixel per 32 bit lane.
+static inline
+Vec v_full_(Vec s, Vec d)
+{
+    VecF a1 = v_channel_(s, COLOR_ALPHA_SHIFT);
+    VecF w1 = v_fmul_(a1, v_fset_(255.0f));
+    VecF w2 = v_fmul_(v_channel_(d, COLOR_ALPHA_SHIFT), v_fsub_(v_fset_(255.0f), a1));
+    VecF den = v_fadd_(w1, w2);
+
+    Vec out = v_shl32_(v_int_(v_div_round_(den, v_fset_(255.0f))), COLOR_ALPHA_SHIFT);
+
+    // lanes with a clear source are replaced by dst below,
+    // just avoid dividing by 0.
+    den = v_fmax_(den, v_fset_(1.0f));
+
+    for (int shift = 0; shift < COLOR_ALPHA_SHIFT; shift += 8)
+    {
+        VecF n = v_fadd_(v_fmul_(w1, v_channel_(s, shift)), v_fmul_(w2, v_channel_(d, shift)));
+        out = v_or_(out, v_shl32_(v_int_(v_div_round_(n, den)), shift));
+    }
+
+    Vec clear = v_eq32_(v_and_(s, v_set32_(COLOR_ALPHA_MASK)), v_set32_(0));
+    return v_or_(v_andnot_(clear, out), v_and_(clear, d));
+}
+
+#endif
+
+void cc_color_blend_overlay_row(const CcPixel *restrict src, CcPixel *restrict dst, int n)
+{
+    int i = 0;
+#ifdef VEC_PIXELS
+    Vec alpha_mask = v_set32_(COLOR_ALPHA_MASK);
+    for (; i + VEC_PIXELS <= n; i += VEC_PIXELS)
+    {
+        Vec s = v_load_(src + i);
+        Vec d = v_load_(dst + i);
+        Vec lo = v_overlay_(v_widen_lo_(s), v_widen_lo_(d));
+        Vec hi = v_overlay_(v_widen_hi_(s), v_widen_hi_(d));
+        v_store_(dst + i, v_or_(v_narrow_(lo, hi), alpha_mask));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = cc_color_blend_overlay(src[i], dst[i]);
+}
+
+void cc_color_blend_invert_row(const CcPixel *restrict src, CcPixel *restrict dst, int n)
+{
+    int i = 0;
+#ifdef VEC_PIXELS
+    Vec alpha_mask = v_set32_(COLOR_ALPHA_MASK);
+    for (; i + VEC_PIXELS <= n; i += VEC_PIXELS)
+    {
+        Vec s = v_load_(src + i);
+        Vec d = v_load_(dst + i);
+        Vec lo = v_invert_(v_widen_lo_(s), v_widen_lo_(d));
+        Vec hi = v_invert_(v_widen_hi_(s), v_widen_hi_(d));
+        // keep destination alpha
+        Vec out = v_or_(v_andnot_(alpha_mask, v_narrow_(lo, hi)), v_and_(alpha_mask, d));
+        v_store_(dst + i, out);
+    }
+#endif
+    for (; i < n; ++i) dst[i] = cc_color_blend_invert(src[i], dst[i]);
+}
+
+void cc_color_blend_multiply_row(const CcPixel *restrict src, CcPixel *restrict dst, int n)
+{
+    int i = 0;
+#ifdef VEC_PIXELS
+    for (; i + VEC_PIXELS <= n; i += VEC_PIXELS)
+    {
+        Vec s = v_load_(src + i);
+        Vec d = v_load_(dst + i);
+        Vec lo = v_mul_255_(v_widen_lo_(s), v_widen_lo_(d));
+        Vec hi = v_mul_255_(v_widen_hi_(s), v_widen_hi_(d));
+        v_store_(dst + i, v_narrow_(lo, hi));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = cc_color_blend_multiply(src[i], dst[i]);
+}
+
+void cc_color_blend_full_row(const CcPixel *restrict src, CcPixel *restrict dst, int n)
+{
+    int i = 0;
+#ifdef VEC_PIXELS
+    Vec alpha_mask = v_set32_(COLOR_ALPHA_MASK);
+    for (; i + VEC_PIXELS <= n; i += VEC_PIXELS)
+    {
+        Vec s = v_load_(src + i);
+        // clear source (like the space around glyphs) leaves dst as is
+        if (v_is_zero_(v_and_(s, alpha_mask))) continue;
+
+        Vec d = v_load_(dst + i);
+        v_store_(dst + i, v_full_(s, d));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = cc_color_blend_full(src[i], dst[i]);
+}
+
+CcBlendRow cc_color_blend_row(CcColorBlend blend)
+{
+    switch (blend)
+    {
+        case COLOR_BLEND_OVERLAY:
+            return cc_color_blend_overlay_row;
+        case COLOR_BLEND_FULL:
+            return cc_color_blend_full_row;
+        case COLOR_BLEND_INVERT:
+            return cc_color_blend_invert_row;
+        case COLOR_BLEND_MULTIPLY:
+            return cc_color_blend_multiply_row;
+        case COLOR_BLEND_REPLACE:
+        default:
+            return NULL;
+    }
+}
+
 static
 void test_fixed_point_(void)
 {
@@ -71,6 +330,46 @@ void test_opaque_(void)
     }
 }
 
+// row kernels must agree with the single pixel versions
+static
+void test_rows_(void)
+{
+    enum { N = 259 };
+    CcPixel src[N];
+    CcPixel dst[N];
+    CcPixel expect[N];
+
+    CcColorBlend modes[] = {
+        COLOR_BLEND_OVERLAY,
+        COLOR_BLEND_FULL,
+        COLOR_BLEND_INVERT,
+        COLOR_BLEND_MULTIPLY
+    };
+    CcPixel (*single[])(CcPixel, CcPixel) = {
+        cc_color_blend_overlay,
+        cc_color_blend_full,
+        cc_color_blend_invert,
+        cc_color_blend_multiply
+    };
+
+    uint32_t seed = 1;
+    for (int m = 0; m < 4; ++m) {
+        CcBlendRow row = cc_color_blend_row(modes[m]);
+
+        for (int trial = 0; trial < 64; ++trial) {
+            for (int i = 0; i < N; ++i) {
+                // cover every alpha value
+                seed = seed * 1664525 + 1013904223;
+                src[i] = (seed & ~COLOR_ALPHA_MASK) | ((uint32_t)((i + trial) & 0xFF) << COLOR_ALPHA_SHIFT);
+                seed = seed * 1664525 + 1013904223;
+                dst[i] = seed;
+                expect[i] = single[m](src[i], dst[i]);
+            }
+            row(src, dst, N);
+            assert(memcmp(dst, expect, sizeof(dst)) == 0);
+        }
+    }
+}
 
 void color_blending_test(void)
 {
@@ -90,10 +389,12 @@ void color_blending_test(void)
     test_invert_();
     test_clear_();
     test_opaque_();
+    test_rows_();
 
-    assert(cc_color_blend_overlay(0xFF000080, 0xFFFFFFFF) == 0xFF7F7FFF);
-    assert(cc_color_blend_full(0xFF000080, 0xFFFFFFFF) == 0xFF7F7FFF);
-    //assert(cc_color_blend_full(0xFF000080, 0xFFFFFF80) == 0xFFc0c0c0);
+    assert(cc_color_blend_overlay(0x80FF0000, 0xFFFFFFFF) == 0xFFFF7F7F);
+    assert(cc_color_blend_full(0x80FF0000, 0xFFFFFFFF) == 0xFFFF7F7F);
+    assert(cc_color_blend_full(0x80FF0000, 0x80FFFFFF) == 0xC0FF5555);
+    assert(cc_color_blend_full(COLOR_CLEAR, 0x00123456) == 0x00123456);
 
     assert(cc_color_blend_overlay(COLOR_WHITE, COLOR_WHITE) == COLOR_WHITE);
     assert(cc_color_blend_overlay(COLOR_CLEAR, COLOR_WHITE) == COLOR_WHITE);
@@ -36,38 +36,52 @@ typedef enum {
 } CcColorBlend;
 
 
+// Pixels are 0xAARRGGBB. That is the order TrueColor visuals
+// (red 0x00FF0000, green 0x0000FF00, blue 0x000000FF) read,
+// so frames go to the display without converting.
+// Image files use R, G, B, A bytes, see cc_color_swap.
 typedef uint32_t CcPixel;
 
+#define COLOR_ALPHA_SHIFT 24
+#define COLOR_ALPHA_MASK 0xFF000000
+// byte of a pixel in memory holding alpha (little endian)
+#define COLOR_ALPHA_BYTE 3
+
 #define COLOR_WHITE 0xFFFFFFFF
-#define COLOR_BLACK 0x000000FF
-#define COLOR_GRAY 0x888888FF
-#define COLOR_RED   0xFF0000FF
-#define COLOR_GREEN 0x00FF00FF
-#define COLOR_BLUE  0x0000FFFF
+#define COLOR_BLACK 0xFF000000
+#define COLOR_GRAY  0xFF888888
+#define COLOR_RED   0xFFFF0000
+#define COLOR_GREEN 0xFF00FF00
+#define COLOR_BLUE  0xFF0000FF
 #define COLOR_CLEAR 0x00000000
 
+// Converts between a pixel and R, G, B, A bytes read as a (little endian) uint32.
+// Swapping twice gives back the original.
 static inline
 CcPixel cc_color_swap(CcPixel x)
 {
-    return ((x & 0xFF000000) >> 24) |
-        ((x & 0x00FF0000) >> 8)  |
-        ((x & 0x0000FF00) << 8)  |
-        ((x & 0x000000FF) << 24);
+    return (x & 0xFF00FF00) |
+        ((x & 0x00FF0000) >> 16) |
+        ((x & 0x000000FF) << 16);
 }
 
+// comps are R, G, B, A
 static inline
 CcPixel cc_color_pack(const uint8_t comps[])
 {
-    CcPixel color;
-    memcpy(&color, comps, sizeof(CcPixel));
-    return cc_color_swap(color);
+    return ((CcPixel)comps[3] << 24) |
+        ((CcPixel)comps[0] << 16) |
+        ((CcPixel)comps[1] << 8) |
+        (CcPixel)comps[2];
 }
 
 static inline
 void cc_color_unpack(CcPixel c, uint8_t comps[])
 {
-    c = cc_color_swap(c);
-    memcpy(comps, &c, sizeof(CcPixel));
+    comps[0] = (uint8_t)(c >> 16);
+    comps[1] = (uint8_t)(c >> 8);
+    comps[2] = (uint8_t)c;
+    comps[3] = (uint8_t)(c >> 24);
 }
 
 // divide by 255
@@ -89,31 +103,34 @@ int16_t fixed_mul_255(int16_t x, int16_t y)
 // http://x86asm.net/articles/fixed-point-arithmetic-and-tricks/
 // https://en.wikipedia.org/wiki/Alpha_compositing
 
+// With integer alphas a1, a2 and colors c1, c2 in [0, 255]:
+//      alpha * 255 = (255 a1 + a2 (255 - a1)) / 255 = d / 255
+//      color * 255 = (255 a1 c1 + a2 c2 (255 - a1)) / d = n / d
+// Both are rounded exactly (half up) with integer division.
 static inline
 void cc_color_blend_full2(
     const uint8_t *restrict src,
     const uint8_t *restrict dst,
     uint8_t *restrict out
 ) {
-    // I would really like a nice integer math one, but couldn't figure out a good way.
-    // This is currently only used for text, so shouldn't be a problem.
-    float a1 = (float)src[3] / 255.0;
-    float a2 = (float)dst[3] / 255.0;
+    int32_t a1 = src[3];
+    if (a1 == 0)
+    {
+        // nothing on top. This also keeps d > 0 below.
+        memcpy(out, dst, 4);
+        return;
+    }
 
-    float alpha = a1 + a2 - a1 * a2;
-    if (alpha > 0.0)
+    int32_t w1 = 255 * a1;
+    int32_t w2 = dst[3] * (255 - a1);
+    int32_t d = w1 + w2;
+
+    for (int i = 0; i < 3; ++i)
     {
-        for (int i = 0; i < 3; ++i)
-        {
-            float c1 = src[i] / 255.0;
-            float c2 = dst[i] / 255.0;
-            
-            float num = a1 * c1 + a2 * c2 * (1.0 - a1);
-            float x = num / alpha;
-            out[i] = round(x * 255.0);
-        }
+        int32_t n = w1 * src[i] + w2 * dst[i];
+        out[i] = (uint8_t)((2 * n + d) / (2 * d));
     }
-    out[3] = round(alpha * 255.0);
+    out[3] = (uint8_t)((2 * d + 255) / 510);
 }
 
 
@@ -227,6 +244,19 @@ CcPixel cc_color_blend_full(
     return cc_color_pack(out_comps);
 }
 
+// Row kernels blend n packed pixels of src on top of dst.
+// They produce the same bits as the single pixel versions above,
+// but work on several pixels at a time (SSE2/AVX2 when available).
+// Pick one with cc_color_blend_row once, then call it for each row.
+typedef void (*CcBlendRow)(const CcPixel *restrict src, CcPixel *restrict dst, int n);
+
+void cc_color_blend_overlay_row(const CcPixel *restrict src, CcPixel *restrict dst, int n);
+void cc_color_blend_invert_row(const CcPixel *restrict src, CcPixel *restrict dst, int n);
+void cc_color_blend_multiply_row(const CcPixel *restrict src, CcPixel *restrict dst, int n);
+void cc_color_blend_full_row(const CcPixel *restrict src, CcPixel *restrict dst, int n);
+
+// returns NULL for COLOR_BLEND_REPLACE, which is just a copy.
+CcBlendRow cc_color_blend_row(CcColorBlend blend);
 
 
 void color_blending_test();
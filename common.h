@@ -58,6 +58,39 @@ unsigned int isqrt(unsigned int y)
     return L;
 }
 
+// xorshift32 random numbers.
+// https://en.wikipedia.org/wiki/Xorshift
+// Keep one per user (not global like rand) so results can be replayed from a seed.
+typedef struct
+{
+    uint32_t state;
+} CcRandom;
+
+static inline
+void cc_random_seed(CcRandom* r, uint32_t seed)
+{
+    // zero is the one state xorshift can't leave
+    r->state = seed ? seed : 0x9E3779B9;
+}
+
+static inline
+uint32_t cc_random_next(CcRandom* r)
+{
+    uint32_t x = r->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    r->state = x;
+    return x;
+}
+
+// uniform in [0, n)
+static inline
+uint32_t cc_random_below(CcRandom* r, uint32_t n)
+{
+    return (uint32_t)(((uint64_t)cc_random_next(r) * n) >> 32);
+}
+
 #ifndef M_PI
 #    define M_PI 3.14159265358979323846
 #endif
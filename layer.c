@@ -27,17 +27,50 @@
 static
 CcBitmap empty_bitmap_ = { 0 };
 
+struct CcMipmap
+{
+    // level i is the layer shrunk by 2 << i
+    CcLayer levels[LAYER_MIP_LEVELS];
+    // 1 for each LAYER_TILE square of a level
+    // that has to be filtered again from the level above.
+    uint8_t* stale[LAYER_MIP_LEVELS];
+};
+
+static
+void mips_free_(CcLayer* layer)
+{
+    struct CcMipmap* m = layer->mips;
+    if (!m) return;
+
+    for (int i = 0; i < LAYER_MIP_LEVELS; ++i)
+    {
+        cc_layer_shutdown(m->levels + i);
+        free(m->stale[i]);
+    }
+    free(m);
+    layer->mips = NULL;
+}
+
 void cc_layer_init(CcLayer* layer, int x, int y)
 {
     layer->bitmap = empty_bitmap_;
     layer->x = x;
     layer->y = y;
     layer->blend = COLOR_BLEND_OVERLAY;
+
+    layer->tiles = NULL;
+    layer->tiles_w = 0;
+    layer->tiles_h = 0;
+
+    layer->mips = NULL;
 }
 
 void cc_layer_shutdown(CcLayer* layer)
 {
     cc_layer_set_bitmap(layer, NULL);
+    free(layer->tiles);
+    layer->tiles = NULL;
+    mips_free_(layer);
 }
 
 void cc_layer_reset(CcLayer* layer)
@@ -56,57 +89,55 @@ void cc_layer_set_bitmap(CcLayer* layer, CcBitmap* new_bitmap)
         cc_bitmap_free(&layer->bitmap);
     }
     layer->bitmap = *new_bitmap;
+    cc_layer_touch_all(layer);
+
+    // nothing left to shrink
+    if (layer->bitmap.w == 0) mips_free_(layer);
 }
 
 void cc_layer_flip(CcLayer* layer, int horiz)
 {
-    CcBitmap n = layer->bitmap;
-    cc_bitmap_alloc(&n);
     if (horiz)
     {
-        cc_bitmap_flip_horiz(&layer->bitmap, &n);
+        cc_bitmap_flip_horiz(&layer->bitmap);
     }
     else
     {
-        cc_bitmap_flip_vert(&layer->bitmap, &n);
+        cc_bitmap_flip_vert(&layer->bitmap);
     }
-    cc_layer_set_bitmap(layer, &n);
+    cc_layer_touch_all(layer);
 }
 
 void cc_layer_rotate_90(CcLayer* layer, int repeat)
 {
-    CcBitmap current = layer->bitmap;
-    CcBitmap next = {
-        .w = current.h,
-        .h = current.w
-    };
-    cc_bitmap_alloc(&next);
+    int turns = ((repeat % 4) + 4) % 4;
+    if (turns == 0) return;
 
-
-    while (repeat > 0) 
+    if (turns == 2)
     {
-        cc_bitmap_rotate_90(&current, &next);
-
-        CcBitmap temp = current;
-        current = next;
-        next = temp;
-        --repeat;
+        // same shape, no need for a second bitmap
+        cc_bitmap_rotate_180(&layer->bitmap);
+        cc_layer_touch_all(layer);
+        return;
     }
-    // forget it ever had it
-    layer->bitmap = empty_bitmap_;
 
-    cc_layer_set_bitmap(layer, &current);
-    cc_bitmap_free(&next);
+    CcBitmap next = {
+        .w = layer->bitmap.h,
+        .h = layer->bitmap.w
+    };
+    cc_bitmap_alloc(&next);
+    cc_bitmap_rotate_90(&layer->bitmap, &next, turns);
+    cc_layer_set_bitmap(layer, &next);
 }
 
 void cc_layer_rotate_angle(CcLayer* layer, double angle, uint32_t bg_color)
 {
     CcTransform rotate = cc_transform_rotate(-M_PI * angle / 180.0);
-    CcBitmap b = cc_bitmap_transform(&layer->bitmap, rotate, bg_color);
+    CcBitmap b = cc_bitmap_transform(&layer->bitmap, rotate, bg_color, RESAMPLE_NEAREST);
     cc_layer_set_bitmap(layer, &b);
 }
 
-void cc_layer_stretch(CcLayer* layer, int w, int h, int w_angle, int h_angle, uint32_t bg_color)
+void cc_layer_stretch(CcLayer* layer, int w, int h, int w_angle, int h_angle, uint32_t bg_color, CcResample filter)
 {
     double sw = (double)w / 100.0;
     double sh = (double)h / 100.0;
@@ -118,7 +149,7 @@ void cc_layer_stretch(CcLayer* layer, int w, int h, int w_angle, int h_angle, ui
     CcTransform skew = cc_transform_skew(ax, ay);
     CcTransform final = cc_transform_concat(scale, skew);
 
-    CcBitmap b = cc_bitmap_transform(&layer->bitmap, final, bg_color);
+    CcBitmap b = cc_bitmap_transform(&layer->bitmap, final, bg_color, filter);
     cc_layer_set_bitmap(layer, &b);
 }
 
@@ -149,6 +180,271 @@ void cc_layer_ensure_size(CcLayer* layer, int w, int h)
     }
 }
 
+// Marks the tiles of map (tiles_w wide) holding part of r.
+static
+void mark_tiles_(uint8_t* map, int tiles_w, int tiles_h, CcRect r, uint8_t value)
+{
+    CcRect tiles = { 0, 0, tiles_w * LAYER_TILE, tiles_h * LAYER_TILE };
+    if (!cc_rect_intersect(r, tiles, &r)) return;
+
+    int end_x = (r.x + r.w - 1) / LAYER_TILE;
+    int end_y = (r.y + r.h - 1) / LAYER_TILE;
+    for (int ty = r.y / LAYER_TILE; ty <= end_y; ++ty)
+    {
+        uint8_t* row = map + ty * tiles_w;
+        for (int tx = r.x / LAYER_TILE; tx <= end_x; ++tx)
+        {
+            row[tx] = value;
+        }
+    }
+}
+
+// r is in layer coordinates
+static
+void mips_touch_(CcLayer* layer, CcRect r)
+{
+    struct CcMipmap* m = layer->mips;
+    for (int i = 0; i < LAYER_MIP_LEVELS; ++i)
+    {
+        const CcBitmap* b = &m->levels[i].bitmap;
+        if (!m->stale[i]) continue;
+
+        int s = 2 << i;
+        CcRect scaled = {
+            int_floor(r.x, s),
+            int_floor(r.y, s),
+            0, 0
+        };
+        scaled.w = int_floor(r.x + r.w + s - 1, s) - scaled.x;
+        scaled.h = int_floor(r.y + r.h + s - 1, s) - scaled.y;
+        mark_tiles_(m->stale[i], int_ceil(b->w, LAYER_TILE), int_ceil(b->h, LAYER_TILE), scaled, 1);
+    }
+}
+
+static
+void forget_tiles_(CcLayer* layer, CcRect r)
+{
+    if (!layer->tiles) return;
+    mark_tiles_(layer->tiles, layer->tiles_w, layer->tiles_h, r, 0);
+}
+
+void cc_layer_touch(CcLayer* layer, CcRect r)
+{
+    r.x -= layer->x;
+    r.y -= layer->y;
+
+    if (layer->mips) mips_touch_(layer, r);
+    forget_tiles_(layer, r);
+}
+
+void cc_layer_touch_all(CcLayer* layer)
+{
+    if (layer->tiles)
+    {
+        memset(layer->tiles, 0, layer->tiles_w * layer->tiles_h);
+    }
+
+    if (layer->mips)
+    {
+        for (int i = 0; i < LAYER_MIP_LEVELS; ++i)
+        {
+            const CcBitmap* b = &layer->mips->levels[i].bitmap;
+            if (layer->mips->stale[i])
+                memset(layer->mips->stale[i], 1, int_ceil(b->w, LAYER_TILE) * int_ceil(b->h, LAYER_TILE));
+        }
+    }
+}
+
+static
+CcCoverage tile_coverage_(CcLayer* layer, int tx, int ty)
+{
+    uint8_t* t = layer->tiles + ty * layer->tiles_w + tx;
+    if (*t == 0)
+    {
+        CcRect r = { tx * LAYER_TILE, ty * LAYER_TILE, LAYER_TILE, LAYER_TILE };
+        cc_rect_intersect(r, cc_bitmap_rect(&layer->bitmap), &r);
+
+        CcBitmap tile = cc_bitmap_view(&layer->bitmap, r);
+        *t = (uint8_t)cc_bitmap_coverage(&tile);
+    }
+    return (CcCoverage)*t;
+}
+
+// transparent source pixels leave these unchanged
+static
+int skips_clear_(CcColorBlend blend)
+{
+    return blend == COLOR_BLEND_OVERLAY
+        || blend == COLOR_BLEND_FULL
+        || blend == COLOR_BLEND_INVERT;
+}
+
+static
+void ensure_tiles_(CcLayer* layer)
+{
+    const CcBitmap* b = &layer->bitmap;
+    int tiles_w = int_ceil(b->w, LAYER_TILE);
+    int tiles_h = int_ceil(b->h, LAYER_TILE);
+    if (layer->tiles_w != tiles_w || layer->tiles_h != tiles_h || !layer->tiles)
+    {
+        free(layer->tiles);
+        layer->tiles = calloc(tiles_w * tiles_h, 1);
+        layer->tiles_w = tiles_w;
+        layer->tiles_h = tiles_h;
+    }
+}
+
+void cc_layer_classify(CcLayer* layer, const CcBitmap* dst, int x, int y)
+{
+    const CcBitmap* b = &layer->bitmap;
+
+    CcRect r = { x, y, b->w, b->h };
+    if (!skips_clear_(layer->blend) || !cc_rect_intersect(r, cc_bitmap_rect(dst), &r)) return;
+
+    ensure_tiles_(layer);
+
+    int x0 = r.x - x;
+    int y0 = r.y - y;
+    for (int ty = y0 / LAYER_TILE; ty <= (y0 + r.h - 1) / LAYER_TILE; ++ty)
+    {
+        for (int tx = x0 / LAYER_TILE; tx <= (x0 + r.w - 1) / LAYER_TILE; ++tx)
+        {
+            tile_coverage_(layer, tx, ty);
+        }
+    }
+}
+
+void cc_layer_blit(CcLayer* layer, CcBitmap* dst, int x, int y)
+{
+    const CcBitmap* b = &layer->bitmap;
+    CcColorBlend blend = layer->blend;
+
+    CcRect r = { x, y, b->w, b->h };
+    if (!cc_rect_intersect(r, cc_bitmap_rect(dst), &r)) return;
+
+    // opaque source pixels replace the destination
+    int copy_opaque = blend == COLOR_BLEND_OVERLAY
+        || blend == COLOR_BLEND_FULL;
+
+    if (!skips_clear_(blend))
+    {
+        cc_bitmap_blit(b, dst, r.x - x, r.y - y, r.x, r.y, r.w, r.h, blend);
+        return;
+    }
+
+    ensure_tiles_(layer);
+
+    // visible part in layer coordinates
+    int x0 = r.x - x;
+    int y0 = r.y - y;
+    int x1 = x0 + r.w;
+    int y1 = y0 + r.h;
+
+    int last_tx = (x1 - 1) / LAYER_TILE;
+    for (int ty = y0 / LAYER_TILE; ty <= (y1 - 1) / LAYER_TILE; ++ty)
+    {
+        int row_y0 = MAX(ty * LAYER_TILE, y0);
+        int row_y1 = MIN((ty + 1) * LAYER_TILE, y1);
+
+        int tx = x0 / LAYER_TILE;
+        while (tx <= last_tx)
+        {
+            // blit runs of tiles with the same coverage together
+            CcCoverage coverage = tile_coverage_(layer, tx, ty);
+            int end = tx + 1;
+            while (end <= last_tx && tile_coverage_(layer, end, ty) == coverage) ++end;
+
+            if (coverage != COVERAGE_CLEAR)
+            {
+                int run_x0 = MAX(tx * LAYER_TILE, x0);
+                int run_x1 = MIN(end * LAYER_TILE, x1);
+
+                cc_bitmap_blit_unsafe(
+                        b,
+                        dst,
+                        run_x0, row_y0,
+                        run_x0 + x, row_y0 + y,
+                        run_x1 - run_x0, row_y1 - row_y0,
+                        (coverage == COVERAGE_OPAQUE && copy_opaque) ? COLOR_BLEND_REPLACE : blend
+                        );
+            }
+            tx = end;
+        }
+    }
+}
+
+// Brings the tiles of level holding part of r (layer coordinates) up to date.
+static
+void update_mip_(CcLayer* layer, int level, CcRect r)
+{
+    struct CcMipmap* m = layer->mips;
+    const CcLayer* above = level == 0 ? layer : m->levels + level - 1;
+    CcLayer* mip = m->levels + level;
+
+    // the same as halving each level above, rounding up.
+    int s = 2 << level;
+    int w = int_ceil(layer->bitmap.w, s);
+    int h = int_ceil(layer->bitmap.h, s);
+    int tiles_w = int_ceil(w, LAYER_TILE);
+    int tiles_h = int_ceil(h, LAYER_TILE);
+
+    if (mip->bitmap.w != w || mip->bitmap.h != h || !m->stale[level])
+    {
+        cc_layer_ensure_size(mip, w, h);
+        free(m->stale[level]);
+        m->stale[level] = malloc(tiles_w * tiles_h);
+        memset(m->stale[level], 1, tiles_w * tiles_h);
+    }
+
+    CcRect scaled = { int_floor(r.x, s), int_floor(r.y, s), 0, 0 };
+    scaled.w = int_floor(r.x + r.w + s - 1, s) - scaled.x;
+    scaled.h = int_floor(r.y + r.h + s - 1, s) - scaled.y;
+    if (!cc_rect_intersect(scaled, cc_bitmap_rect(&mip->bitmap), &scaled)) return;
+
+    for (int ty = scaled.y / LAYER_TILE; ty <= (scaled.y + scaled.h - 1) / LAYER_TILE; ++ty)
+    {
+        uint8_t* row = m->stale[level] + ty * tiles_w;
+        for (int tx = scaled.x / LAYER_TILE; tx <= (scaled.x + scaled.w - 1) / LAYER_TILE; ++tx)
+        {
+            if (!row[tx]) continue;
+
+            CcRect tile = { tx * LAYER_TILE, ty * LAYER_TILE, LAYER_TILE, LAYER_TILE };
+            cc_rect_intersect(tile, cc_bitmap_rect(&mip->bitmap), &tile);
+
+            if (level > 0)
+            {
+                CcRect source = { tile.x * s, tile.y * s, tile.w * s, tile.h * s };
+                update_mip_(layer, level - 1, source);
+            }
+
+            cc_bitmap_halve(&above->bitmap, &mip->bitmap, tile);
+            forget_tiles_(mip, tile);
+            row[tx] = 0;
+        }
+    }
+}
+
+CcLayer* cc_layer_mip(CcLayer* layer, int shrink, CcRect r)
+{
+    if (shrink == 1) return layer;
+
+    int level = 0;
+    while ((2 << level) < shrink) ++level;
+    assert((2 << level) == shrink && level < LAYER_MIP_LEVELS);
+
+    if (!layer->mips) layer->mips = calloc(1, sizeof(struct CcMipmap));
+
+    r.x -= layer->x;
+    r.y -= layer->y;
+    update_mip_(layer, level, r);
+
+    CcLayer* mip = layer->mips->levels + level;
+    mip->x = int_floor(layer->x, shrink);
+    mip->y = int_floor(layer->y, shrink);
+    mip->blend = layer->blend;
+    return mip;
+}
+
 typedef struct
 {
     char* name;
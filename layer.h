@@ -22,6 +22,19 @@
 #include "transform.h"
 #include "bitmap_text.h"
 
+#define LAYER_TILE 64
+// mips go down to 1 / (1 << LAYER_MIP_LEVELS), small enough for an overview.
+// Levels are only made when something asks for them.
+#define LAYER_MIP_LEVELS 6
+// The view zooms out to 1 / VIEW_MAX_SHRINK. Further out the image is too small
+// to work on, the deeper mips are for the navigator.
+#define VIEW_MAX_SHRINK 8
+// Between two mip levels the view shows the bigger one resampled
+// to fraction / VIEW_FRACTION_ONE, e.g. 3/8 is the 1/2 mip at 3/4.
+#define VIEW_FRACTION_ONE 4
+
+struct CcMipmap;
+
 typedef struct
 {
     CcBitmap bitmap;
@@ -29,6 +42,16 @@ typedef struct
 
     int x;
     int y;
+
+    // CcCoverage of each LAYER_TILE square, 0 when unknown.
+    // filled in lazily by cc_layer_blit.
+    uint8_t* tiles;
+    int tiles_w;
+    int tiles_h;
+
+    // Box filtered halves of bitmap, for drawing zoomed out.
+    // NULL until cc_layer_mip asks for one.
+    struct CcMipmap* mips;
 } CcLayer;
 
 static inline
@@ -59,10 +82,29 @@ void cc_layer_flip(CcLayer* layer, int horiz);
 void cc_layer_set_bitmap(CcLayer* layer, CcBitmap* new_bitmap);
 void cc_layer_rotate_90(CcLayer* layer, int repeat);
 void cc_layer_rotate_angle(CcLayer* layer, double angle, uint32_t bg_color);
-void cc_layer_stretch(CcLayer* layer, int w, int h, int w_angle, int h_angle, uint32_t bg_color);
+void cc_layer_stretch(CcLayer* layer, int w, int h, int w_angle, int h_angle, uint32_t bg_color, CcResample filter);
 void cc_layer_resize(CcLayer* layer, int new_w, int new_h, uint32_t bg_color);
 void cc_layer_ensure_size(CcLayer* layer, int w, int h);
 
+// Pixels in r (paint coordinates) changed and their tiles (and mips) must be looked at again.
+// The cc_layer functions above do this themselves,
+// drawing straight into layer->bitmap needs to report it.
+void cc_layer_touch(CcLayer* layer, CcRect r);
+void cc_layer_touch_all(CcLayer* layer);
+
+// Blits the layer with its blend mode, placing the layer's origin at (x, y) in dst.
+// Clear tiles are skipped and opaque tiles are copied when the blend allows it.
+void cc_layer_blit(CcLayer* layer, CcBitmap* dst, int x, int y);
+// Classifies the tiles cc_layer_blit would read, so parts of dst
+// can then be blitted from several threads.
+void cc_layer_classify(CcLayer* layer, const CcBitmap* dst, int x, int y);
+
+// The layer shrunk by shrink (a power of two, at most 1 << LAYER_MIP_LEVELS),
+// with the part r (paint coordinates) brought up to date.
+// Each level is made from the one above, and only tiles touched since are filtered again.
+// Its origin is the layer's divided by shrink. For shrink 1 it's the layer itself.
+CcLayer* cc_layer_mip(CcLayer* layer, int shrink, CcRect r);
+
 #define CC_TEXT_STRING_MAX 8192
 
 typedef struct
@@ -95,6 +137,12 @@ typedef struct
     int h;
 
     int zoom;
+    // Zoomed out, each view pixel shows shrink x shrink paint pixels.
+    // A power of two. zoom is 1 when this is more than 1.
+    int shrink;
+    // Those pixels are then resampled to fraction / VIEW_FRACTION_ONE.
+    // VIEW_FRACTION_ONE for none, zoom is 1 when it is less.
+    int fraction;
 
 } CcViewport;
 
@@ -105,31 +153,117 @@ void cc_viewport_init(CcViewport* v)
     v->paint_y = 0;
 
     v->zoom = 1;
+    v->shrink = 1;
+    v->fraction = VIEW_FRACTION_ONE;
 
     v->w = 0;
     v->h = 0;
 }
 
+// Top left of the view in paint pixels divided by shrink.
+// Compositing works at this scale, so moving the view less than shrink changes nothing.
+// Resampled views step by VIEW_FRACTION_ONE of those, which is a whole number of view pixels.
+static inline
+CcCoord cc_viewport_origin(const CcViewport* v)
+{
+    int step = v->fraction == VIEW_FRACTION_ONE ? 1 : VIEW_FRACTION_ONE;
+    CcCoord o = {
+        int_floor(v->paint_x, v->shrink * step) * step,
+        int_floor(v->paint_y, v->shrink * step) * step
+    };
+    return o;
+}
+
 static inline
 void cc_viewport_coord_to_paint(const CcViewport* v, int x, int y, int* out_x, int* out_y)
 {
-    *out_x = (x / v->zoom) + v->paint_x;
-    *out_y = (y / v->zoom) + v->paint_y;
+    CcCoord o = cc_viewport_origin(v);
+    int d = v->zoom * v->fraction;
+    *out_x = (x * VIEW_FRACTION_ONE / d + o.x) * v->shrink;
+    *out_y = (y * VIEW_FRACTION_ONE / d + o.y) * v->shrink;
+}
+
+// Paint pixels across and down the view.
+static inline
+int cc_viewport_paint_w(const CcViewport* v)
+{
+    return v->w * v->shrink * VIEW_FRACTION_ONE / (v->zoom * v->fraction);
+}
+
+static inline
+int cc_viewport_paint_h(const CcViewport* v)
+{
+    return v->h * v->shrink * VIEW_FRACTION_ONE / (v->zoom * v->fraction);
+}
+
+// r (paint coordinates) in viewport pixels.
+// Zoomed out it grows to the view pixels it touches.
+static inline
+CcRect cc_viewport_from_paint(const CcViewport* v, CcRect r)
+{
+    CcCoord o = cc_viewport_origin(v);
+    int s = v->shrink;
+    int x0 = int_floor(r.x - o.x * s, s);
+    int y0 = int_floor(r.y - o.y * s, s);
+    int x1 = int_floor(r.x + r.w - o.x * s + s - 1, s);
+    int y1 = int_floor(r.y + r.h - o.y * s + s - 1, s);
+
+    if (v->fraction != VIEW_FRACTION_ONE)
+    {
+        // This also covers the view pixels that blend a changed pixel with its neighbour.
+        int f = v->fraction;
+        x0 = int_floor(x0 * f, VIEW_FRACTION_ONE);
+        y0 = int_floor(y0 * f, VIEW_FRACTION_ONE);
+        x1 = int_floor(x1 * f + VIEW_FRACTION_ONE - 1, VIEW_FRACTION_ONE);
+        y1 = int_floor(y1 * f + VIEW_FRACTION_ONE - 1, VIEW_FRACTION_ONE);
+    }
+
+    CcRect out = {
+        x0 * v->zoom,
+        y0 * v->zoom,
+        (x1 - x0) * v->zoom,
+        (y1 - y0) * v->zoom
+    };
+    return out;
+}
+
+// Grows region (viewport pixels) to whole zoomed pixels.
+// blocks gets it in paint pixels (divided by shrink) from the view's origin.
+// Returns the grown region in viewport pixels, clipped to the view.
+static inline
+CcRect cc_viewport_blocks(const CcViewport* v, CcRect region, CcRect* blocks)
+{
+    int zoom = v->zoom;
+    blocks->x = region.x / zoom;
+    blocks->y = region.y / zoom;
+    blocks->w = int_ceil(region.x + region.w, zoom) - blocks->x;
+    blocks->h = int_ceil(region.y + region.h, zoom) - blocks->y;
+
+    // image may not evenly divide by the zoom factor
+    CcRect out = {
+        blocks->x * zoom,
+        blocks->y * zoom,
+        MIN(blocks->w * zoom, v->w - blocks->x * zoom),
+        MIN(blocks->h * zoom, v->h - blocks->y * zoom)
+    };
+    return out;
 }
 
 static inline
-CcViewport cc_viewport_zoom_centered(const CcViewport* v, int new_zoom)
+CcViewport cc_viewport_zoom_centered(const CcViewport* v, int new_zoom, int new_shrink, int new_fraction)
 {
     CcViewport out;
     out.w = v->w;
     out.h = v->h;
     out.zoom = new_zoom;
+    out.shrink = new_shrink;
+    out.fraction = new_fraction;
 
-    int center_x = v->paint_x + v->w / (2 * v->zoom);
-    int center_y = v->paint_y + v->h / (2 * v->zoom);
+    int center_x = v->paint_x + cc_viewport_paint_w(v) / 2;
+    int center_y = v->paint_y + cc_viewport_paint_h(v) / 2;
 
-    out.paint_x = center_x - v->w / (2 * new_zoom);
-    out.paint_y = center_y - v->h / (2 * new_zoom);
+    out.paint_x = center_x - cc_viewport_paint_w(&out) / 2;
+    out.paint_y = center_y - cc_viewport_paint_h(&out) / 2;
 
     return out;
 }
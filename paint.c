@@ -16,8 +16,10 @@
 
 #include <ctype.h>
 #include <assert.h>
+#include <time.h>
 
 #include "paint.h"
+#include "parallel.h"
 
 #include "stb_image.h"
 #include "stb_image_write.h"
@@ -41,9 +43,42 @@ void paint_undo_save_full(PaintContext* ctx)
     }
 }
 
+static
+void damage_layer_(PaintContext* ctx, const CcLayer* l)
+{
+    if (l->bitmap.w != 0)
+    {
+        paint_damage(ctx, cc_layer_rect(l));
+    }
+}
+
+static
+void damage_around_(PaintContext* ctx, int x1, int y1, int x2, int y2, int pad)
+{
+    paint_damage(ctx, cc_rect_pad(cc_rect_around_corners(x1, y1, x2, y2), pad, pad));
+}
+
+// previews redraw the whole overlay, but only the old and new shape change.
+static
+void damage_preview_(PaintContext* ctx, CcRect bounds)
+{
+    paint_damage(ctx, ctx->preview_bounds);
+    paint_damage(ctx, bounds);
+    ctx->preview_bounds = bounds;
+}
+
+static
+void clear_preview_(PaintContext* ctx)
+{
+    CcRect empty = { 0 };
+    damage_preview_(ctx, empty);
+}
+
 void paint_undo(PaintContext* ctx)
 {
     cc_undo_maybe_back(&ctx->undo, ctx->layers + LAYER_MAIN);
+    clear_preview_(ctx);
+    paint_damage_all(ctx);
 
     ctx->active_layer = LAYER_MAIN;
     cc_layer_reset(ctx->layers + LAYER_OVERLAY);
@@ -53,6 +88,9 @@ void paint_undo(PaintContext* ctx)
 void paint_redo(PaintContext* ctx)
 {
     cc_undo_maybe_forward(&ctx->undo, ctx->layers + LAYER_MAIN);
+    cc_layer_touch_all(ctx->layers + LAYER_MAIN);
+    clear_preview_(ctx);
+    paint_damage_all(ctx);
 
     ctx->active_layer = LAYER_MAIN;
     cc_layer_reset(ctx->layers + LAYER_OVERLAY);
@@ -93,6 +131,7 @@ int paint_open_file(PaintContext* ctx, const char* path, const char** error_mess
         }
         b.w = w;
         b.h = h;
+        b.stride = w * sizeof(CcPixel);
         b.data = (CcPixel *)data;
         cc_bitmap_swap_channels(&b);
         strncpy(ctx->open_file_path, path, OS_PATH_MAX);
@@ -103,6 +142,7 @@ int paint_open_file(PaintContext* ctx, const char* path, const char** error_mess
     ctx->active_layer = LAYER_MAIN;
 
     cc_viewport_init(&ctx->viewport);
+    paint_damage_all(ctx);
 
     paint_undo_save_full(ctx);
 	return 1;
@@ -154,15 +194,14 @@ int save_file_(PaintContext* ctx, const char* path)
         printf("saving file: %s %d\n", path, mode);
     }
 
-    const CcLayer* l = ctx->layers + LAYER_MAIN;
-
-    CcBitmap b = l->bitmap;
-    cc_bitmap_alloc(&b);
-    cc_bitmap_copy(&l->bitmap, &b);
+    // swap the canvas in place and back again, instead of copying it.
+    // bmp, tga and jpg writers can't take a stride, but canvas is always packed.
+    CcBitmap b = ctx->layers[LAYER_MAIN].bitmap;
+    assert(cc_bitmap_is_packed(&b));
     cc_bitmap_swap_channels(&b);
 
     const int comp = 4;
-    int stride = b.w * sizeof(uint32_t);
+    int stride = b.stride;
 
     int success;
     switch (mode)
@@ -182,7 +221,7 @@ int save_file_(PaintContext* ctx, const char* path)
             break;
     }
 
-    cc_bitmap_free(&b);
+    cc_bitmap_swap_channels(&b);
     return success;
 }
 
@@ -211,6 +250,7 @@ int paint_init(PaintContext* ctx)
     ctx->tool_force_align = 0;
 
     cc_viewport_init(&ctx->viewport);
+    cc_viewport_init(&ctx->damage_viewport);
 
     ctx->tool = TOOL_BRUSH;
     ctx->previous_tool = TOOL_BRUSH;
@@ -224,6 +264,7 @@ int paint_init(PaintContext* ctx)
 
     ctx->select_mode = SELECT_KEEP_BG;
     ctx->request_tool_timer = 0;
+    paint_seed_random(ctx, 1);
 
     ctx->text = (CcText) {
         .font_size = 12,
@@ -237,14 +278,26 @@ int paint_init(PaintContext* ctx)
     cc_polygon_init(&ctx->polygon);
 
     ctx->undo = (CcUndo) { 0 };
+    ctx->preview_bounds = (CcRect) { 0 };
+    ctx->damage = (CcRect) { 0 };
+    ctx->damage_all = 1;
+    ctx->thumbnail_damage = (CcRect) { 0 };
+    ctx->thumbnail_damage_all = 1;
     paint_open_file(ctx, NULL, NULL);
     return 1;
 }
 
+void paint_seed_random(PaintContext* ctx, uint32_t seed)
+{
+    cc_random_seed(&ctx->random, seed);
+}
+
 void paint_invert_colors(PaintContext* ctx)
 {
     CcLayer* l = ctx->layers + ctx->active_layer;
     cc_bitmap_invert_colors(&l->bitmap);
+    cc_layer_touch_all(l);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -252,6 +305,7 @@ void paint_flip(PaintContext* ctx, int horiz)
 {
     CcLayer* l = ctx->layers + ctx->active_layer;
     cc_layer_flip(l, horiz);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -259,6 +313,7 @@ void paint_rotate_90(PaintContext* ctx, int repeat)
 {
     CcLayer* l = ctx->layers + ctx->active_layer;
     cc_layer_rotate_90(l, repeat);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -266,6 +321,7 @@ void paint_rotate_angle(PaintContext* ctx, double angle)
 {
     CcLayer* l = ctx->layers + ctx->active_layer;
     cc_layer_rotate_angle(l, angle, ctx->bg_color);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -273,7 +329,13 @@ void paint_stretch(PaintContext* ctx, int w, int h, int w_angle, int h_angle)
 {
     if (DEBUG_LOG) printf("stretch %d, %d, %d, %d\n", w, h, w_angle, h_angle);
     CcLayer* l = ctx->layers + ctx->active_layer;
-    cc_layer_stretch(l, w, h, w_angle, h_angle, ctx->bg_color);
+    // shrinking averages pixels, nearest would drop most of them.
+    // growing keeps hard pixel edges, and so do skews,
+    // which would otherwise be bilinear and blend in bg_color (see cc_bitmap_transform).
+    int skewed = w_angle != 0 || h_angle != 0;
+    CcResample filter = (!skewed && (w < 100 || h < 100)) ? RESAMPLE_BOX : RESAMPLE_NEAREST;
+    cc_layer_stretch(l, w, h, w_angle, h_angle, ctx->bg_color, filter);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -281,6 +343,8 @@ void paint_clear(PaintContext* ctx)
 {
     CcLayer* l = ctx->layers + ctx->active_layer;
     cc_bitmap_clear(&l->bitmap, ctx->bg_color);
+    cc_layer_touch_all(l);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -288,6 +352,7 @@ void paint_resize(PaintContext* ctx, int new_w, int new_h)
 {
     CcLayer* l = ctx->layers + ctx->active_layer;
     cc_layer_resize(l, new_w, new_h, ctx->bg_color);
+    paint_damage_all(ctx);
     paint_undo_save_full(ctx);
 }
 
@@ -326,16 +391,59 @@ static
 void prepare_empty_overlay_(PaintContext* ctx)
 {
     CcLayer* l = ctx->layers + LAYER_OVERLAY;
+    clear_preview_(ctx);
     l->x = 0;
     l->y = 0;
 
-    cc_layer_ensure_size(l, paint_w(ctx), paint_h(ctx));
-    cc_bitmap_clear(&l->bitmap, COLOR_CLEAR);
+    // previews size it to their shape, see begin_preview_
+    cc_layer_set_bitmap(l, NULL);
     l->blend = COLOR_BLEND_OVERLAY;
 
     cc_text_set_string(&ctx->text, L"");
 }
 
+// The overlay only covers the preview's bounds (clipped to the canvas),
+// so drawing a preview costs the size of the shape, not the image.
+// The overlay is cleared and shapes are drawn at paint coordinates minus the returned origin.
+static
+CcCoord begin_preview_(PaintContext* ctx, CcRect bounds, CcColorBlend blend)
+{
+    CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
+
+    if (!cc_rect_intersect(bounds, cc_layer_rect(ctx->layers + LAYER_MAIN), &bounds))
+    {
+        bounds = (CcRect) { 0 };
+    }
+
+    // dotted lines follow x % 8, keep the origin on that grid.
+    int align_x = bounds.x % 8;
+    int align_y = bounds.y % 8;
+    bounds.x -= align_x;
+    bounds.w += align_x;
+    bounds.y -= align_y;
+    bounds.h += align_y;
+
+    damage_preview_(ctx, bounds);
+
+    if (cc_rect_empty(bounds))
+    {
+        cc_layer_set_bitmap(overlay, NULL);
+    }
+    else
+    {
+        cc_layer_ensure_size(overlay, bounds.w, bounds.h);
+        cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
+        cc_layer_touch_all(overlay);
+    }
+
+    overlay->x = bounds.x;
+    overlay->y = bounds.y;
+    overlay->blend = blend;
+
+    CcCoord origin = { bounds.x, bounds.y };
+    return origin;
+}
+
 static
 void settle_selection_layer_(PaintContext* ctx)
 {
@@ -351,6 +459,7 @@ void settle_selection_layer_(PaintContext* ctx)
 
         cc_bitmap_blit(&l->bitmap, b, 0, 0, l->x, l->y, cc_layer_w(l), cc_layer_h(l), l->blend);
         paint_undo_save(ctx, l->x, l->y, l->bitmap.w, l->bitmap.h);
+        damage_layer_(ctx, l);
 
         cc_layer_reset(l);
         ctx->active_layer = LAYER_MAIN;
@@ -394,6 +503,7 @@ void settle_polygon_(PaintContext* ctx)
         ctx->line_width
     );
     paint_undo_save(ctx, r.x, r.y, r.w, r.h);
+    paint_damage(ctx, r);
     cc_polygon_clear(&ctx->polygon);
     prepare_empty_overlay_(ctx);
 }
@@ -411,20 +521,24 @@ void paint_set_tool(PaintContext* ctx, PaintTool tool)
     settle_selection_layer_(ctx);
 }
 
+static
+void stroke_shifted_polygon_(PaintContext* ctx, CcBitmap* b, CcCoord origin, int width, CcPixel color)
+{
+    CcCoord to_overlay = { -origin.x, -origin.y };
+    CcCoord back = { origin.x, origin.y };
+
+    cc_polygon_shift(&ctx->polygon, to_overlay);
+    cc_bitmap_stroke_polygon(b, ctx->polygon.points, ctx->polygon.count, 0, width, color);
+    cc_polygon_shift(&ctx->polygon, back);
+}
+
 static
 void redraw_polygon_(PaintContext* ctx)
 {
     CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-    cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
-
-    cc_bitmap_stroke_polygon(
-            &overlay->bitmap,
-            ctx->polygon.points,
-            ctx->polygon.count,
-            0,
-            ctx->line_width,
-            fg_color_(ctx)
-            );
+    CcRect bounds = cc_rect_pad(cc_polygon_rect(&ctx->polygon), ctx->line_width, ctx->line_width);
+    CcCoord origin = begin_preview_(ctx, bounds, COLOR_BLEND_OVERLAY);
+    stroke_shifted_polygon_(ctx, &overlay->bitmap, origin, ctx->line_width, fg_color_(ctx));
 }
 
 static
@@ -443,12 +557,15 @@ void paint_tool_down(PaintContext* ctx, int x, int y, int button)
     {
         case TOOL_PENCIL:
             cc_bitmap_draw_square(b, x, y, ctx->line_width, fg_color_(ctx));
+            damage_around_(ctx, x, y, x, y, ctx->line_width);
             break;
         case TOOL_ERASER:
             cc_bitmap_draw_square(b, x, y, ctx->eraser_width, bg_color_(ctx));
+            damage_around_(ctx, x, y, x, y, ctx->eraser_width);
             break;
         case TOOL_BRUSH:
             cc_bitmap_draw_circle(b, x, y, ctx->brush_width,  fg_color_(ctx));
+            damage_around_(ctx, x, y, x, y, ctx->brush_width);
             break;
         case TOOL_SPRAY_CAN:
             ctx->request_tool_timer = 1;
@@ -461,11 +578,14 @@ void paint_tool_down(PaintContext* ctx, int x, int y, int button)
                 {
                     CcRect r = cc_bitmap_flood_fill(b, x, y, fg_color_(ctx));
                     paint_undo_save(ctx, r.x, r.y, r.w, r.h);
+                    paint_damage(ctx, r);
                     break;
                 }
                 case BUCKET_GLOBAL:
                  cc_bitmap_replace(b, cc_bitmap_get(b, x, y, 0), fg_color_(ctx));
+                 cc_layer_touch_all(ctx->layers + LAYER_MAIN);
                  paint_undo_save_full(ctx);
+                 paint_damage_all(ctx);
                  break;
             }
             break;
@@ -560,12 +680,15 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
     {
         case TOOL_PENCIL:
             cc_bitmap_interp_square(b, ctx->tool_x, ctx->tool_y, x, y, ctx->line_width, fg_color_(ctx));
+            damage_around_(ctx, ctx->tool_x, ctx->tool_y, x, y, ctx->line_width);
             break;
         case TOOL_ERASER:
             cc_bitmap_interp_square(b, ctx->tool_x, ctx->tool_y, x, y, ctx->eraser_width, bg_color_(ctx));
+            damage_around_(ctx, ctx->tool_x, ctx->tool_y, x, y, ctx->eraser_width);
             break;
         case TOOL_BRUSH:
             cc_bitmap_interp_circle(b, ctx->tool_x, ctx->tool_y, x, y, ctx->brush_width,  fg_color_(ctx));
+            damage_around_(ctx, ctx->tool_x, ctx->tool_y, x, y, ctx->brush_width);
             break;
         case TOOL_MAGNIFIER:
         {
@@ -575,9 +698,9 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
                 int h = ctx->viewport.h / ctx->zoom_level;
 
                 CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-                overlay->blend = COLOR_BLEND_INVERT;
-                cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
-                cc_bitmap_stroke_rect(&overlay->bitmap,  x - w/2, y - h/2, x + w/2, y + h/2, 1, COLOR_BLACK);
+                CcRect bounds = cc_rect_pad(cc_rect_around_corners(x - w/2, y - h/2, x + w/2, y + h/2), 1, 1);
+                CcCoord o = begin_preview_(ctx, bounds, COLOR_BLEND_INVERT);
+                cc_bitmap_stroke_rect(&overlay->bitmap,  x - w/2 - o.x, y - h/2 - o.y, x + w/2 - o.x, y + h/2 - o.y, 1, COLOR_BLACK);
             }
             break;
         }
@@ -589,8 +712,9 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
             }
 
             CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-            cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
-            cc_bitmap_interp_square(&overlay->bitmap, ctx->line_x, ctx->line_y, x, y, ctx->line_width, fg_color_(ctx));
+            CcRect bounds = cc_rect_pad(cc_rect_around_corners(ctx->line_x, ctx->line_y, x, y), ctx->line_width, ctx->line_width);
+            CcCoord o = begin_preview_(ctx, bounds, COLOR_BLEND_OVERLAY);
+            cc_bitmap_interp_square(&overlay->bitmap, ctx->line_x - o.x, ctx->line_y - o.y, x - o.x, y - o.y, ctx->line_width, fg_color_(ctx));
             break;
         }
         case TOOL_RECTANGLE:
@@ -601,15 +725,16 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
             }
  
             CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-            cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
+            CcRect bounds = cc_rect_pad(cc_rect_around_corners(ctx->line_x, ctx->line_y, x, y), ctx->line_width, ctx->line_width);
+            CcCoord o = begin_preview_(ctx, bounds, COLOR_BLEND_OVERLAY);
 
             if (ctx->shape_flags & SHAPE_FILL)
             {
-                cc_bitmap_fill_rect(&overlay->bitmap, ctx->line_x, ctx->line_y, x, y, shape_fill_color_(ctx));
+                cc_bitmap_fill_rect(&overlay->bitmap, ctx->line_x - o.x, ctx->line_y - o.y, x - o.x, y - o.y, shape_fill_color_(ctx));
             }
             if (ctx->shape_flags & SHAPE_STROKE)
             {
-                cc_bitmap_stroke_rect(&overlay->bitmap, ctx->line_x, ctx->line_y, x, y, ctx->line_width, shape_stroke_color_(ctx));
+                cc_bitmap_stroke_rect(&overlay->bitmap, ctx->line_x - o.x, ctx->line_y - o.y, x - o.x, y - o.y, ctx->line_width, shape_stroke_color_(ctx));
             }
             break;
         }
@@ -621,15 +746,16 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
             }
  
             CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-            cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
+            CcRect bounds = cc_rect_pad(cc_rect_around_corners(ctx->line_x, ctx->line_y, x, y), 1, 1);
+            CcCoord o = begin_preview_(ctx, bounds, COLOR_BLEND_OVERLAY);
 
             if (ctx->shape_flags & SHAPE_FILL)
             {
-                cc_bitmap_fill_ellipse(&overlay->bitmap, ctx->line_x, ctx->line_y, x, y, shape_fill_color_(ctx));
+                cc_bitmap_fill_ellipse(&overlay->bitmap, ctx->line_x - o.x, ctx->line_y - o.y, x - o.x, y - o.y, shape_fill_color_(ctx));
             }
             if (ctx->shape_flags & SHAPE_STROKE)
             {
-                cc_bitmap_stroke_ellipse(&overlay->bitmap, ctx->line_x, ctx->line_y, x, y, shape_stroke_color_(ctx));
+                cc_bitmap_stroke_ellipse(&overlay->bitmap, ctx->line_x - o.x, ctx->line_y - o.y, x - o.x, y - o.y, shape_stroke_color_(ctx));
             }
             break;
         }
@@ -638,26 +764,21 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
             if (ctx->active_layer == LAYER_OVERLAY)
             {
                 CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
+                damage_layer_(ctx, overlay);
                 overlay->x += x - ctx->tool_x;
                 overlay->y += y - ctx->tool_y;
+                damage_layer_(ctx, overlay);
             }
             else
             {
                 CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-                overlay->blend = COLOR_BLEND_INVERT;
 
                 CcCoord coord = { x, y };
                 cc_polygon_add(&ctx->polygon, coord);
-                cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
-
-                cc_bitmap_stroke_polygon(
-                        &overlay->bitmap,
-                        ctx->polygon.points,
-                        ctx->polygon.count,
-                        0,
-                        1,
-                        COLOR_BLACK
-                        );
+
+                CcRect bounds = cc_rect_pad(cc_polygon_rect(&ctx->polygon), 1, 1);
+                CcCoord o = begin_preview_(ctx, bounds, COLOR_BLEND_INVERT);
+                stroke_shifted_polygon_(ctx, &overlay->bitmap, o, 1, COLOR_BLACK);
             }
             break;
         }
@@ -687,15 +808,17 @@ void paint_tool_move(PaintContext* ctx, int x, int y)
             if (ctx->active_layer == LAYER_OVERLAY)
             {
                 CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
+                damage_layer_(ctx, overlay);
                 overlay->x += x - ctx->tool_x;
                 overlay->y += y - ctx->tool_y;
+                damage_layer_(ctx, overlay);
             }
             else
             {
                 CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
-                overlay->blend = COLOR_BLEND_INVERT;
-                cc_bitmap_clear(&overlay->bitmap, COLOR_CLEAR);
-                cc_bitmap_dotted_rect(&overlay->bitmap, ctx->line_x, ctx->line_y, x, y, COLOR_BLACK);
+                CcRect bounds = cc_rect_around_corners(ctx->line_x, ctx->line_y, x, y);
+                CcCoord o = begin_preview_(ctx, bounds, COLOR_BLEND_INVERT);
+                cc_bitmap_dotted_rect(&overlay->bitmap, ctx->line_x - o.x, ctx->line_y - o.y, x - o.x, y - o.y, COLOR_BLACK);
             }
             break;
         }
@@ -716,7 +839,8 @@ void paint_tool_update(PaintContext* ctx)
     switch (ctx->tool)
     {
         case TOOL_SPRAY_CAN:
-            cc_bitmap_draw_spray(b, ctx->tool_x, ctx->tool_y, ctx->brush_width, SPRAY_DENSITY, fg_color_(ctx));
+            cc_bitmap_draw_spray(b, ctx->tool_x, ctx->tool_y, ctx->brush_width, SPRAY_DENSITY, fg_color_(ctx), &ctx->random);
+            damage_around_(ctx, ctx->tool_x, ctx->tool_y, ctx->tool_x, ctx->tool_y, ctx->brush_width);
             break;
         default:
             break;
@@ -749,6 +873,7 @@ void push_undo_box_(PaintContext* ctx, int end_x, int end_y, int radius)
     r = cc_rect_pad(r, radius, radius);
     cc_rect_intersect(r, cc_layer_rect(l), &r);
     paint_undo_save(ctx, r.x, r.y, r.w, r.h);
+    paint_damage(ctx, r);
 }
 
 void paint_tool_up(PaintContext* ctx, int x, int y, int button)
@@ -780,6 +905,8 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
                int h = ctx->viewport.h / ctx->zoom_level;
 
                ctx->viewport.zoom = ctx->zoom_level;
+               ctx->viewport.shrink = 1;
+               ctx->viewport.fraction = VIEW_FRACTION_ONE;
                ctx->viewport.paint_x = MIN(MAX(x - w / 2, 0), paint_w(ctx));
                ctx->viewport.paint_y = MIN(MAX(y - h / 2, 0), paint_h(ctx));
                paint_set_tool(ctx, ctx->previous_tool);
@@ -787,10 +914,13 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
            else
            {
                ctx->viewport.zoom = 1;
+               ctx->viewport.shrink = 1;
+               ctx->viewport.fraction = VIEW_FRACTION_ONE;
                ctx->viewport.paint_x = 0;
                ctx->viewport.paint_y = 0;
            }
 
+           clear_preview_(ctx);
            cc_layer_reset(ctx->layers + LAYER_OVERLAY);
            break;
         case TOOL_LINE:
@@ -799,6 +929,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
                 cc_line_align_to_45(ctx->line_x, ctx->line_y, x, y, &x, &y);
             }
 
+            clear_preview_(ctx);
             cc_layer_set_bitmap(ctx->layers + LAYER_OVERLAY, NULL);
             cc_bitmap_interp_square(b, ctx->line_x, ctx->line_y, x, y, ctx->line_width, fg_color_(ctx));
             push_undo_box_(ctx, x, y, ctx->line_width);
@@ -808,6 +939,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
             {
                 align_rect_to_square(ctx->line_x, ctx->line_y, x, y, &x, &y);
             }
+            clear_preview_(ctx);
             cc_layer_set_bitmap(ctx->layers + LAYER_OVERLAY, NULL);
 
             if (ctx->shape_flags & SHAPE_FILL)
@@ -825,6 +957,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
             {
                 align_rect_to_square(ctx->line_x, ctx->line_y, x, y, &x, &y);
             }
+            clear_preview_(ctx);
             cc_layer_set_bitmap(ctx->layers + LAYER_OVERLAY, NULL);
 
             if (ctx->shape_flags & SHAPE_FILL)
@@ -841,6 +974,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
         {
             if (ctx->active_layer == LAYER_MAIN)
             {
+                clear_preview_(ctx);
                 cc_polygon_cleanup(&ctx->polygon, 1);
                 paint_select_polygon(ctx);
             }
@@ -854,6 +988,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
             if (ctx->active_layer == LAYER_MAIN)
             {
                 CcRect rect = cc_rect_around_corners(x, y, ctx->line_x, ctx->line_y);
+                clear_preview_(ctx);
                 if (rect.w > 0 && rect.h > 0)
                 {
                     CcBitmap b = {
@@ -870,6 +1005,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
 
                     cc_text_set_string(&ctx->text, L"");
                     ctx->active_layer = LAYER_OVERLAY;
+                    damage_layer_(ctx, overlay);
                 }
             }
             break;
@@ -877,6 +1013,7 @@ void paint_tool_up(PaintContext* ctx, int x, int y, int button)
             if (ctx->active_layer == LAYER_MAIN)
             {
                 CcRect rect = cc_rect_around_corners(x, y, ctx->line_x, ctx->line_y);
+                clear_preview_(ctx);
                 paint_select(ctx, rect.x, rect.y, rect.w, rect.h);
             }
             break;
@@ -907,66 +1044,501 @@ void paint_crop(PaintContext* ctx)
         CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
         CcLayer* main = ctx->layers + LAYER_MAIN;
 
+        // hand the overlay pixels to main, no copy needed.
         CcBitmap b = overlay->bitmap;
-        cc_bitmap_alloc(&b);
-        cc_bitmap_copy(&overlay->bitmap, &b);
+        overlay->bitmap.data = NULL;
+        cc_layer_reset(overlay);
 
         cc_layer_set_bitmap(main, &b);
-        cc_layer_reset(overlay);
 
         ctx->active_layer = LAYER_MAIN;
         paint_undo_save_full(ctx);
+        paint_damage_all(ctx);
     }
 }
 
-void paint_composite(PaintContext* ctx, CcBitmap *composite)
+void paint_damage(PaintContext* ctx, CcRect r)
 {
-    assert(composite->w == ctx->viewport.w);
-    assert(composite->h == ctx->viewport.h);
+    ctx->damage = cc_rect_union(ctx->damage, r);
+    ctx->thumbnail_damage = cc_rect_union(ctx->thumbnail_damage, r);
+    cc_layer_touch(ctx->layers + LAYER_MAIN, r);
+    cc_layer_touch(ctx->layers + LAYER_OVERLAY, r);
+}
 
+void paint_damage_all(PaintContext* ctx)
+{
+    ctx->damage_all = 1;
+    ctx->thumbnail_damage_all = 1;
+}
+
+const CcBitmap* paint_thumbnail(PaintContext* ctx, int w, int h, CcRect* out_changed)
+{
+    CcLayer* main = ctx->layers + LAYER_MAIN;
+    *out_changed = (CcRect) { 0 };
+    if (main->bitmap.w == 0) return NULL;
+
+    int shrink = 1;
+    while (shrink < (1 << LAYER_MIP_LEVELS)
+            && int_ceil(main->bitmap.w, shrink * 2) >= w
+            && int_ceil(main->bitmap.h, shrink * 2) >= h)
+    {
+        shrink *= 2;
+    }
+
+    CcRect changed = ctx->thumbnail_damage;
+    if (ctx->thumbnail_damage_all || shrink != ctx->thumbnail_shrink)
+    {
+        changed = cc_layer_rect(main);
+    }
+    ctx->thumbnail_damage = (CcRect) { 0 };
+    ctx->thumbnail_damage_all = 0;
+    ctx->thumbnail_shrink = shrink;
+
+    // the mips only filter tiles touched since they were last asked for.
+    const CcLayer* level = cc_layer_mip(main, shrink, cc_layer_rect(main));
+
+    if (!cc_rect_empty(changed))
+    {
+        int x0 = int_floor(changed.x - main->x, shrink);
+        int y0 = int_floor(changed.y - main->y, shrink);
+        CcRect r = {
+            x0,
+            y0,
+            int_floor(changed.x + changed.w - main->x + shrink - 1, shrink) - x0,
+            int_floor(changed.y + changed.h - main->y + shrink - 1, shrink) - y0
+        };
+        if (cc_rect_intersect(r, cc_bitmap_rect(&level->bitmap), &r)) *out_changed = r;
+    }
+    return &level->bitmap;
+}
+
+// same size and scale
+static
+int same_scale_(const CcViewport* a, const CcViewport* b)
+{
+    return a->w == b->w && a->h == b->h && a->zoom == b->zoom && a->shrink == b->shrink && a->fraction == b->fraction;
+}
+
+// r (snapshot pixels) in paint coordinates, grown to the composited pixels it shows.
+static
+CcRect snapshot_to_paint_(const CcViewport* v, CcRect r)
+{
+    CcCoord o = cc_viewport_origin(v);
+    int f = v->fraction;
+    int x0 = int_floor(r.x * VIEW_FRACTION_ONE, f);
+    int y0 = int_floor(r.y * VIEW_FRACTION_ONE, f);
+    int x1 = int_floor((r.x + r.w) * VIEW_FRACTION_ONE + f - 1, f);
+    int y1 = int_floor((r.y + r.h) * VIEW_FRACTION_ONE + f - 1, f);
+
+    int s = v->shrink;
+    CcRect out = { (o.x + x0) * s, (o.y + y0) * s, (x1 - x0) * s, (y1 - y0) * s };
+    return out;
+}
+
+int paint_collect_scroll(PaintContext* ctx, CcCoord* out_move)
+{
+    const CcViewport* v = &ctx->viewport;
+    CcViewport* last = &ctx->damage_viewport;
+
+    // in composited pixels, which are bigger than paint pixels when zoomed out.
+    CcCoord o = cc_viewport_origin(v);
+    CcCoord last_o = cc_viewport_origin(last);
+    int dx = o.x - last_o.x;
+    int dy = o.y - last_o.y;
+
+    if ((dx == 0 && dy == 0) || ctx->damage_all) return 0;
+    if (!same_scale_(v, last)) return 0;
+
+    // in snapshot pixels. The origin moves so these come out whole when resampling.
+    dx = dx * v->fraction / VIEW_FRACTION_ONE;
+    dy = dy * v->fraction / VIEW_FRACTION_ONE;
+
+    // blocks on screen, the last ones may be cut off
+    int view_w = int_ceil(v->w, v->zoom);
+    int view_h = int_ceil(v->h, v->zoom);
+    int whole_w = v->w / v->zoom;
+    int whole_h = v->h / v->zoom;
+
+    // nothing left to reuse
+    if (abs(dx) >= whole_w || abs(dy) >= whole_h) return 0;
+
+    // Uncovered strips. Moving towards the cut off blocks
+    // brings their missing part into view, so those are redrawn too.
+    CcRect columns = dx > 0
+        ? (CcRect) { whole_w - dx, 0, view_w - whole_w + dx, view_h }
+        : (CcRect) { 0, 0, -dx, view_h };
+    CcRect rows = dy > 0
+        ? (CcRect) { 0, whole_h - dy, view_w, view_h - whole_h + dy }
+        : (CcRect) { 0, 0, view_w, -dy };
+
+    ctx->damage = cc_rect_union(ctx->damage, snapshot_to_paint_(v, columns));
+    ctx->damage = cc_rect_union(ctx->damage, snapshot_to_paint_(v, rows));
+
+    *last = *v;
+    out_move->x = dx;
+    out_move->y = dy;
+    return 1;
+}
+
+int paint_collect_damage(PaintContext* ctx, CcRect* out_rect)
+{
+    const CcViewport* v = &ctx->viewport;
+    const CcViewport* last = &ctx->damage_viewport;
+
+    // text is laid out here, so its damage is known before compositing.
     if (ctx->text.dirty && paint_is_editing_text(ctx)) {
         cc_text_composite(&ctx->text, ctx->layers + LAYER_OVERLAY);
         ctx->text.dirty = 0;
+        damage_layer_(ctx, ctx->layers + LAYER_OVERLAY);
     }
 
-    assert(ctx->viewport.w >= 0);
-    assert(ctx->viewport.h >= 0);
-    assert(ctx->viewport.zoom > 0);
+    CcCoord o = cc_viewport_origin(v);
+    CcCoord last_o = cc_viewport_origin(last);
+    if (o.x != last_o.x || o.y != last_o.y || !same_scale_(v, last))
+    {
+        ctx->damage_viewport = *v;
+        ctx->damage_all = 1;
+    }
 
-    int vx = ctx->viewport.paint_x;
-    int vy = ctx->viewport.paint_y;
+    CcRect view = { 0, 0, v->w, v->h };
+    CcRect r = view;
 
-    // image may not evenly divide by the zoom factor
-    int target_w = int_ceil(ctx->viewport.w, ctx->viewport.zoom);
-    int target_h = int_ceil(ctx->viewport.h, ctx->viewport.zoom);
+    if (!ctx->damage_all)
+    {
+        r = cc_viewport_from_paint(v, ctx->damage);
+    }
 
-    cc_layer_ensure_size(ctx->layers + LAYER_INTERMEDIATE, target_w, target_h);
+    ctx->damage = (CcRect) { 0 };
+    ctx->damage_all = 0;
 
-    int needs_zoom = ctx->viewport.zoom != 1;
+    if (cc_rect_empty(r) || !cc_rect_intersect(r, view, &r))
+    {
+        *out_rect = (CcRect) { 0 };
+        return 0;
+    }
 
-    CcBitmap* target = needs_zoom ? &ctx->layers[LAYER_INTERMEDIATE].bitmap : composite;
-    cc_bitmap_clear(target, ctx->view_bg_color);
+    *out_rect = r;
+    return 1;
+}
+
+// Compositing goes tile by tile. Each tile is cleared, blended, zoomed
+// and converted while it is in cache, and written to dst once.
+// Tiles don't depend on each other, so any split over threads gives the same bytes.
+// Tiles are about this big once zoomed, wide so zoomed rows are copied in long runs.
+#define COMPOSITE_TILE_W 256
+#define COMPOSITE_TILE_H 64
+
+typedef struct
+{
+    // NULL when src already holds the blended blocks.
+    PaintContext* ctx;
+    CcRect blocks;
+    // what each layer draws from, its mip when zoomed out.
+    // NULL for layers that are empty or not blended.
+    CcLayer* layers[LAYER_COUNT];
+    CcCoord origin;
+    // the blocks at zoom 1, the same as dst when blending at zoom 1.
+    // unused when blending zoomed, tiles blend on the stack instead.
+    CcBitmap src;
+    CcBitmap dst;
+    // where dst is (viewport pixels)
+    CcCoord dst_origin;
+    int zoom;
+    CcRowFilter filter;
+    CcCompositeDone done;
+    void* done_ctx;
+
+    // tile size in blocks, and how many across and down
+    int tile_w;
+    int tile_h;
+    int tiles_w;
+    int tiles_h;
+} CompositeJob;
+
+static
+void blend_layers_(const CompositeJob* job, CcBitmap* target, CcRect blocks)
+{
+    cc_bitmap_clear(target, job->ctx->view_bg_color);
 
     for (int i = LAYER_MAIN; i < LAYER_COUNT; ++i)
     {
-        const CcLayer* l = ctx->layers + i;
-        if (l->bitmap.w != 0)
+        CcLayer* l = job->layers[i];
+        if (l)
+        {
+            int x = l->x - job->origin.x - blocks.x;
+            int y = l->y - job->origin.y - blocks.y;
+            cc_layer_blit(l, target, x, y);
+        }
+    }
+}
+
+// t is in blocks, relative to job->blocks
+static
+void composite_tile_(const CompositeJob* job, CcRect t)
+{
+    int zoom = job->zoom;
+
+    // zoomed tiles are at most half as big in blocks
+    CcPixel scratch[(COMPOSITE_TILE_W / 2) * (COMPOSITE_TILE_H / 2)];
+    CcBitmap src;
+    if (job->ctx && zoom != 1)
+    {
+        assert(t.w * t.h <= (int)(sizeof(scratch) / sizeof(CcPixel)));
+        src = (CcBitmap) {
+            .w = t.w,
+            .h = t.h,
+            .stride = t.w * sizeof(CcPixel),
+            .data = scratch
+        };
+    }
+    else
+    {
+        src = cc_bitmap_view(&job->src, t);
+    }
+
+    if (job->ctx)
+    {
+        CcRect blocks = { job->blocks.x + t.x, job->blocks.y + t.y, t.w, t.h };
+        blend_layers_(job, &src, blocks);
+    }
+
+    // the last tiles may hang over the edge of dst
+    int x0 = t.x * zoom;
+    int y0 = t.y * zoom;
+    CcRect out = {
+        x0,
+        y0,
+        MIN((t.x + t.w) * zoom, job->dst.w) - x0,
+        MIN((t.y + t.h) * zoom, job->dst.h) - y0
+    };
+    CcBitmap dst = cc_bitmap_view(&job->dst, out);
+
+    if (zoom != 1)
+    {
+        cc_bitmap_zoom(&src, &dst, zoom, job->filter);
+    }
+    else
+    {
+        if (src.data != dst.data) cc_bitmap_copy(&src, &dst);
+        if (job->filter) cc_bitmap_filter(&dst, job->filter);
+    }
+
+    if (job->done)
+    {
+        out.x += job->dst_origin.x;
+        out.y += job->dst_origin.y;
+        job->done(job->done_ctx, out);
+    }
+}
+
+// tiles [start, end), numbered across then down.
+static
+void composite_tiles_(void* ctx, int start, int end)
+{
+    const CompositeJob* job = ctx;
+
+    for (int i = start; i < end; ++i)
+    {
+        int x = (i % job->tiles_w) * job->tile_w;
+        int y = (i / job->tiles_w) * job->tile_h;
+        CcRect t = {
+            x,
+            y,
+            MIN(job->tile_w, job->blocks.w - x),
+            MIN(job->tile_h, job->blocks.h - y)
+        };
+        composite_tile_(job, t);
+    }
+}
+
+// Splits the job into tiles. They only read tiles and mips of the layers,
+// so those are sorted out here first.
+static
+void prepare_composite_(CompositeJob* job)
+{
+    job->tile_w = MAX(1, COMPOSITE_TILE_W / job->zoom);
+    job->tile_h = MAX(1, COMPOSITE_TILE_H / job->zoom);
+    job->tiles_w = int_ceil(job->blocks.w, job->tile_w);
+    job->tiles_h = int_ceil(job->blocks.h, job->tile_h);
+
+    if (!job->ctx) return;
+
+    const CcViewport* v = &job->ctx->viewport;
+    int s = v->shrink;
+    job->origin = cc_viewport_origin(v);
+
+    // the blocks in paint coordinates
+    CcRect r = {
+        (job->origin.x + job->blocks.x) * s,
+        (job->origin.y + job->blocks.y) * s,
+        job->blocks.w * s,
+        job->blocks.h * s
+    };
+
+    // the bounds of every layer tile read
+    CcBitmap bounds = { .w = job->blocks.w, .h = job->blocks.h };
+
+    for (int i = 0; i < LAYER_COUNT; ++i)
+    {
+        CcLayer* l = job->ctx->layers + i;
+        job->layers[i] = NULL;
+        if (l->bitmap.w == 0) continue;
+
+        // zoomed out reads 1 / s^2 of the pixels.
+        l = cc_layer_mip(l, s, r);
+        job->layers[i] = l;
+
+        int x = l->x - job->origin.x - job->blocks.x;
+        int y = l->y - job->origin.y - job->blocks.y;
+        cc_layer_classify(l, &bounds, x, y);
+    }
+}
+
+static
+void run_composite_(CompositeJob* job)
+{
+    prepare_composite_(job);
+
+    // a couple of tiles a thread at least, waking one costs about as much.
+    cc_parallel_for(job->tiles_w * job->tiles_h, 2, composite_tiles_, job);
+}
+
+// Where snapshot pixel x samples the composited pixels (in 1/256ths) when resampling.
+// Pixel centers line up, so the composited pixel left of it is (pos >> 8) with weight 256 - (pos & 255).
+static inline
+int sample_pos_(int x, int fraction)
+{
+    return (((2 * x + 1) * VIEW_FRACTION_ONE - fraction) << 8) / (2 * fraction);
+}
+
+// a + (b - a) * t / 256, two channels at a time.
+static inline
+CcPixel lerp_(CcPixel a, CcPixel b, int t)
+{
+    uint32_t rb = ((a & 0x00FF00FF) * (256 - t) + (b & 0x00FF00FF) * t) >> 8;
+    uint32_t ag = ((a >> 8) & 0x00FF00FF) * (256 - t) + ((b >> 8) & 0x00FF00FF) * t;
+    return (rb & 0x00FF00FF) | (ag & 0xFF00FF00);
+}
+
+typedef struct
+{
+    // composited pixels, from where the first row and column of r sample
+    CcBitmap src;
+    CcCoord src_origin;
+    CcBitmap* dst;
+    CcRect r;
+    int fraction;
+} ResampleJob;
+
+// rows [start, end) of job->r
+static
+void resample_rows_(void* ctx, int start, int end)
+{
+    const ResampleJob* job = ctx;
+    const CcRect r = job->r;
+
+    for (int y = r.y + start; y < r.y + end; ++y)
+    {
+        int py = sample_pos_(y, job->fraction);
+        int sy = (py >> 8) - job->src_origin.y;
+        const CcPixel* top = cc_bitmap_row(&job->src, sy);
+        const CcPixel* bottom = cc_bitmap_row(&job->src, sy + 1);
+        CcPixel* out = cc_bitmap_row(job->dst, y);
+
+        for (int x = r.x; x < r.x + r.w; ++x)
         {
-            cc_bitmap_blit(
-                    &l->bitmap,
-                    target,
-                    0, 0,
-                    l->x - vx, l->y - vy,
-                    cc_layer_w(l), cc_layer_h(l),
-                    l->blend
-                    );
+            int px = sample_pos_(x, job->fraction);
+            int sx = (px >> 8) - job->src_origin.x;
+            CcPixel a = lerp_(top[sx], top[sx + 1], px & 255);
+            CcPixel b = lerp_(bottom[sx], bottom[sx + 1], px & 255);
+            out[x] = lerp_(a, b, py & 255);
         }
     }
+}
+
+// Between mip levels the bigger one is composited as usual,
+// then shrunk into r of the snapshot with one bilinear pass.
+static
+void resample_snapshot_(PaintContext* ctx, CcBitmap* snapshot, CcRect r)
+{
+    int f = ctx->viewport.fraction;
+
+    // the composited pixels r reads
+    int x0 = sample_pos_(r.x, f) >> 8;
+    int y0 = sample_pos_(r.y, f) >> 8;
+    int x1 = (sample_pos_(r.x + r.w - 1, f) >> 8) + 2;
+    int y1 = (sample_pos_(r.y + r.h - 1, f) >> 8) + 2;
+
+    ResampleJob resample = {
+        .src = { .w = x1 - x0, .h = y1 - y0 },
+        .src_origin = { x0, y0 },
+        .dst = snapshot,
+        .r = r,
+        .fraction = f
+    };
+    cc_bitmap_alloc(&resample.src);
+
+    CompositeJob job = {
+        .ctx = ctx,
+        .blocks = { x0, y0, x1 - x0, y1 - y0 },
+        .src = resample.src,
+        .dst = resample.src,
+        .zoom = 1
+    };
+    run_composite_(&job);
+
+    cc_parallel_for(r.h, 16, resample_rows_, &resample);
+    cc_bitmap_free(&resample.src);
+}
+
+void paint_snapshot(PaintContext* ctx, CcBitmap* snapshot, CcRect blocks)
+{
+    assert(snapshot->w == int_ceil(ctx->viewport.w, ctx->viewport.zoom));
+    assert(snapshot->h == int_ceil(ctx->viewport.h, ctx->viewport.zoom));
+
+    CcRect clipped;
+    if (!cc_rect_intersect(blocks, cc_bitmap_rect(snapshot), &clipped)) return;
 
-    if (needs_zoom)
+    if (ctx->viewport.fraction != VIEW_FRACTION_ONE)
     {
-        cc_bitmap_zoom(target, composite, ctx->viewport.zoom);
+        resample_snapshot_(ctx, snapshot, clipped);
+        return;
     }
+
+    CompositeJob job = {
+        .ctx = ctx,
+        .blocks = clipped,
+        .src = cc_bitmap_view(snapshot, clipped),
+        .zoom = 1
+    };
+    job.dst = job.src;
+
+    run_composite_(&job);
+}
+
+void paint_zoom_snapshot(const CcViewport* v, const CcBitmap* snapshot, CcBitmap* composite, CcRowFilter filter, CcCompositeDone done, void* done_ctx, CcRect region)
+{
+    assert(composite->w == v->w);
+    assert(composite->h == v->h);
+
+    if (!cc_rect_intersect(region, cc_bitmap_rect(composite), &region)) return;
+
+    CcRect blocks;
+    CcRect out = cc_viewport_blocks(v, region, &blocks);
+
+    CompositeJob job = {
+        .ctx = NULL,
+        .blocks = blocks,
+        .src = cc_bitmap_view(snapshot, blocks),
+        .dst = cc_bitmap_view(composite, out),
+        .dst_origin = { out.x, out.y },
+        .zoom = v->zoom,
+        .filter = filter,
+        .done = done,
+        .done_ctx = done_ctx
+    };
+
+    run_composite_(&job);
 }
 
 
@@ -986,6 +1558,7 @@ void paint_copy(PaintContext* ctx)
 void paint_cut(PaintContext* ctx)
 {
     paint_copy(ctx);
+    damage_layer_(ctx, ctx->layers + LAYER_OVERLAY);
     cc_layer_reset(ctx->layers + LAYER_OVERLAY);
     ctx->active_layer = LAYER_MAIN;
 }
@@ -1003,6 +1576,7 @@ void paint_paste(PaintContext* ctx)
     CcBitmap b = cc_bitmap_decompress(ctx->paste_board_data, ctx->paste_board_size);
     cc_layer_set_bitmap(overlay, &b);
     ctx->active_layer = LAYER_OVERLAY;
+    damage_layer_(ctx, overlay);
 }
 
 void paint_select_all(PaintContext* ctx)
@@ -1022,20 +1596,10 @@ void paint_select(PaintContext* ctx, int x, int y, int w, int h)
     };
     if (!cc_rect_intersect(rect, cc_layer_rect(l), &rect)) return;
 
-    CcBitmap b = {
-        .w = rect.w,
-        .h = rect.h
-    };
+    CcBitmap selection = cc_bitmap_view(&l->bitmap, rect);
+    CcBitmap b = selection;
     cc_bitmap_alloc(&b);
-    cc_bitmap_clear(&b, bg_color_(ctx));
-    cc_bitmap_blit(
-            &l->bitmap,
-            &b,
-            rect.x, rect.y,
-            0, 0,
-            rect.w, rect.h,
-            COLOR_BLEND_REPLACE
-            );
+    cc_bitmap_copy(&selection, &b);
 
     if (ctx->select_mode == SELECT_IGNORE_BG)
     {
@@ -1059,6 +1623,7 @@ void paint_select(PaintContext* ctx, int x, int y, int w, int h)
 
     paint_undo_save(ctx, overlay->x, overlay->y, cc_layer_w(overlay), cc_layer_h(overlay));
     ctx->active_layer = LAYER_OVERLAY;
+    damage_layer_(ctx, overlay);
 }
 
 void paint_select_polygon(PaintContext* ctx)
@@ -1085,17 +1650,10 @@ void paint_select_polygon(PaintContext* ctx)
     cc_bitmap_stroke_polygon(&mask, ctx->polygon.points, ctx->polygon.count, 1, 1, COLOR_WHITE);
 
     /* copy selection into new bitmap */
-    CcBitmap b = mask;
+    CcBitmap selection = cc_bitmap_view(&l->bitmap, rect);
+    CcBitmap b = selection;
     cc_bitmap_alloc(&b);
-    cc_bitmap_clear(&b, bg_color_(ctx));
-    cc_bitmap_blit(
-            &l->bitmap,
-            &b,
-            rect.x, rect.y,
-            0, 0,
-            rect.w, rect.h,
-            COLOR_BLEND_REPLACE
-            );
+    cc_bitmap_copy(&selection, &b);
 
     if (ctx->select_mode == SELECT_IGNORE_BG)
     {
@@ -1119,12 +1677,14 @@ void paint_select_polygon(PaintContext* ctx)
 
     paint_undo_save(ctx, overlay->x, overlay->y, cc_layer_w(overlay), cc_layer_h(overlay));
     ctx->active_layer = LAYER_OVERLAY;
+    damage_layer_(ctx, overlay);
 }
 
 void paint_select_clear(PaintContext* ctx)
 {
     paint_set_tool(ctx, TOOL_SELECT_RECTANGLE);
     ctx->active_layer = LAYER_MAIN;
+    damage_layer_(ctx, ctx->layers + LAYER_OVERLAY);
     cc_layer_reset(ctx->layers + LAYER_OVERLAY);
 }
 
@@ -1147,3 +1707,329 @@ int paint_is_editing_text(PaintContext* ctx)
     return ctx->tool == TOOL_TEXT && ctx->active_layer == LAYER_OVERLAY;
 }
 
+// the whole view into composite, on every thread
+static
+void composite_view_(PaintContext* ctx, CcBitmap* composite)
+{
+    CcRect blocks;
+    CcRect out = cc_viewport_blocks(&ctx->viewport, cc_bitmap_rect(composite), &blocks);
+
+    CompositeJob job = {
+        .ctx = ctx,
+        .blocks = blocks,
+        .dst = cc_bitmap_view(composite, out),
+        .zoom = ctx->viewport.zoom
+    };
+    job.src = job.dst;
+
+    run_composite_(&job);
+}
+
+// the whole view one step at a time with plain blits,
+// which know nothing of tile coverage.
+static
+void composite_reference_(PaintContext* ctx, CcBitmap* composite)
+{
+    int zoom = ctx->viewport.zoom;
+    CcRect blocks;
+    CcRect out = cc_viewport_blocks(&ctx->viewport, cc_bitmap_rect(composite), &blocks);
+
+    // only to find the mips
+    CompositeJob job = {
+        .ctx = ctx,
+        .blocks = blocks,
+        .zoom = zoom
+    };
+    prepare_composite_(&job);
+
+    CcBitmap whole = { .w = blocks.w, .h = blocks.h };
+    cc_bitmap_alloc(&whole);
+    cc_bitmap_clear(&whole, ctx->view_bg_color);
+
+    for (int i = 0; i < LAYER_COUNT; ++i)
+    {
+        const CcLayer* l = job.layers[i];
+        if (!l) continue;
+
+        int x = l->x - job.origin.x - blocks.x;
+        int y = l->y - job.origin.y - blocks.y;
+        cc_bitmap_blit(&l->bitmap, &whole, 0, 0, x, y, l->bitmap.w, l->bitmap.h, l->blend);
+    }
+
+    CcBitmap dst = cc_bitmap_view(composite, out);
+    if (zoom != 1)
+        cc_bitmap_zoom(&whole, &dst, zoom, NULL);
+    else
+        cc_bitmap_copy(&whole, &dst);
+    cc_bitmap_free(&whole);
+}
+
+// A picture with white, noise and an overlay with clear, opaque and mixed tiles.
+// scale makes it bigger for timing.
+static void test_layers_(PaintContext* ctx, int scale)
+{
+    for (int i = 0; i < LAYER_COUNT; ++i)
+        cc_layer_init(ctx->layers + i, 0, 0);
+
+    ctx->view_bg_color = COLOR_GRAY;
+    cc_viewport_init(&ctx->viewport);
+    cc_viewport_init(&ctx->damage_viewport);
+
+    CcRandom random;
+    cc_random_seed(&random, 7);
+
+    CcLayer* main_layer = ctx->layers + LAYER_MAIN;
+    cc_layer_ensure_size(main_layer, 600 * scale, 400 * scale);
+    for (int y = 0; y < main_layer->bitmap.h; ++y)
+    {
+        CcPixel* row = cc_bitmap_row(&main_layer->bitmap, y);
+        for (int x = 0; x < main_layer->bitmap.w; ++x)
+            row[x] = y < 140 * scale ? COLOR_WHITE : cc_random_next(&random);
+    }
+
+    CcLayer* overlay = ctx->layers + LAYER_OVERLAY;
+    cc_layer_ensure_size(overlay, 240 * scale, 180 * scale);
+    overlay->x = 180 * scale;
+    overlay->y = 80 * scale;
+    overlay->blend = COLOR_BLEND_FULL;
+    for (int y = 0; y < overlay->bitmap.h; ++y)
+    {
+        CcPixel* row = cc_bitmap_row(&overlay->bitmap, y);
+        for (int x = 0; x < overlay->bitmap.w; ++x)
+            row[x] = x < LAYER_TILE ? COLOR_CLEAR : (x < 2 * LAYER_TILE ? COLOR_GREEN : cc_random_next(&random));
+    }
+
+    cc_layer_touch_all(main_layer);
+    cc_layer_touch_all(overlay);
+}
+
+// Tiles must give the same bytes as compositing the whole view one step at a time
+// with plain blits, on one thread or many, also after part of a layer changes.
+void compositing_test(void)
+{
+    printf("testing compositing\n");
+
+    static PaintContext ctx;
+    test_layers_(&ctx, 1);
+
+    CcLayer* main_layer = ctx.layers + LAYER_MAIN;
+    CcLayer* overlay = ctx.layers + LAYER_OVERLAY;
+
+    // zoom, shrink
+    const int scales[][2] = { { 1, 1 }, { 3, 1 }, { 1, 4 } };
+    for (int k = 0; k < 3; ++k)
+    {
+        int zoom = scales[k][0];
+        int shrink = scales[k][1];
+        ctx.viewport.w = 700;
+        ctx.viewport.h = 300;
+        ctx.viewport.zoom = zoom;
+        ctx.viewport.shrink = shrink;
+        ctx.viewport.paint_x = -40;
+        ctx.viewport.paint_y = 10;
+
+        CcBitmap serial = { .w = ctx.viewport.w, .h = ctx.viewport.h };
+        CcBitmap tiled = serial;
+        CcBitmap passes = serial;
+        cc_bitmap_alloc(&serial);
+        cc_bitmap_alloc(&tiled);
+        cc_bitmap_alloc(&passes);
+
+        CcRect blocks;
+        CcRect out = cc_viewport_blocks(&ctx.viewport, cc_bitmap_rect(&serial), &blocks);
+
+        CompositeJob job = {
+            .ctx = &ctx,
+            .blocks = blocks,
+            .dst = cc_bitmap_view(&serial, out),
+            .zoom = zoom,
+        };
+        job.src = job.dst;
+
+        composite_reference_(&ctx, &passes);
+
+        prepare_composite_(&job);
+        composite_tiles_(&job, 0, job.tiles_w * job.tiles_h);
+
+        composite_view_(&ctx, &tiled);
+
+        for (int y = 0; y < serial.h; ++y)
+        {
+            assert(memcmp(cc_bitmap_row(&serial, y), cc_bitmap_row(&tiled, y), serial.w * sizeof(CcPixel)) == 0);
+            assert(memcmp(cc_bitmap_row(&passes, y), cc_bitmap_row(&tiled, y), serial.w * sizeof(CcPixel)) == 0);
+        }
+
+        {
+            // Change pixels after the tiles were classified, touching only that part.
+            // The opaque column of tiles gets clear pixels and the clear one opaque pixels.
+            CcRect cleared = { LAYER_TILE + 6 + 5 * k, 20, 40, 30 };
+            CcRect filled = { 5, 100 + 7 * k, 40, 30 };
+            CcBitmap part = cc_bitmap_view(&overlay->bitmap, cleared);
+            cc_bitmap_clear(&part, COLOR_CLEAR);
+            part = cc_bitmap_view(&overlay->bitmap, filled);
+            cc_bitmap_clear(&part, COLOR_BLUE);
+
+            // touch takes paint coordinates
+            cleared.x += overlay->x;
+            cleared.y += overlay->y;
+            filled.x += overlay->x;
+            filled.y += overlay->y;
+            cc_layer_touch(overlay, cleared);
+            cc_layer_touch(overlay, filled);
+
+            composite_view_(&ctx, &tiled);
+            composite_reference_(&ctx, &passes);
+
+            for (int y = 0; y < serial.h; ++y)
+                assert(memcmp(cc_bitmap_row(&passes, y), cc_bitmap_row(&tiled, y), serial.w * sizeof(CcPixel)) == 0);
+        }
+
+        if (shrink > 1)
+        {
+            // Only touched tiles of the mips are filtered again,
+            // that must give the same as filtering everything.
+            CcRect stroke = { 201, 73, 117, 35 };
+            CcBitmap part = cc_bitmap_view(&main_layer->bitmap, stroke);
+            cc_bitmap_clear(&part, COLOR_RED);
+            cc_layer_touch(main_layer, stroke);
+            composite_view_(&ctx, &tiled);
+
+            cc_layer_touch_all(main_layer);
+            composite_view_(&ctx, &serial);
+
+            for (int y = 0; y < serial.h; ++y)
+                assert(memcmp(cc_bitmap_row(&serial, y), cc_bitmap_row(&tiled, y), serial.w * sizeof(CcPixel)) == 0);
+        }
+
+        cc_bitmap_free(&serial);
+        cc_bitmap_free(&tiled);
+        cc_bitmap_free(&passes);
+    }
+
+    {
+        // 3/8 resamples the 1/2 mip. Redrawing only what changed
+        // or scrolled into view must give the same as redrawing everything.
+        CcViewport* v = &ctx.viewport;
+        v->zoom = 1;
+        v->shrink = 2;
+        v->fraction = VIEW_FRACTION_ONE * 3 / 4;
+        v->paint_x = -40;
+        v->paint_y = 10;
+
+        CcBitmap part = { .w = v->w, .h = v->h };
+        CcBitmap whole = part;
+        cc_bitmap_alloc(&part);
+        cc_bitmap_alloc(&whole);
+
+        CcRect damage;
+        paint_damage_all(&ctx);
+        paint_collect_damage(&ctx, &damage);
+        paint_snapshot(&ctx, &part, damage);
+
+        for (int k = 0; k < 3; ++k)
+        {
+            if (k == 0)
+            {
+                CcRect stroke = { 233, 91, 57, 23 };
+                CcBitmap b = cc_bitmap_view(&main_layer->bitmap, stroke);
+                cc_bitmap_clear(&b, COLOR_BLUE);
+                paint_damage(&ctx, stroke);
+            }
+            else
+            {
+                // one way at a time, or the strips' bounds are the whole view
+                if (k == 1) v->paint_x += 37;
+                else v->paint_y -= 21;
+                CcCoord move;
+                int scrolled = paint_collect_scroll(&ctx, &move);
+                assert(scrolled);
+                cc_bitmap_shift(&part, move.x, move.y);
+            }
+
+            if (paint_collect_damage(&ctx, &damage)) paint_snapshot(&ctx, &part, damage);
+            paint_snapshot(&ctx, &whole, cc_bitmap_rect(&whole));
+
+            for (int y = 0; y < whole.h; ++y)
+                assert(memcmp(cc_bitmap_row(&part, y), cc_bitmap_row(&whole, y), whole.w * sizeof(CcPixel)) == 0);
+        }
+
+        cc_bitmap_free(&part);
+        cc_bitmap_free(&whole);
+    }
+
+    for (int i = 0; i < LAYER_COUNT; ++i)
+        cc_layer_shutdown(ctx.layers + i);
+}
+
+static double seconds_(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+void compositing_benchmark(void)
+{
+    const int frames = 8;
+    int threads = cc_parallel_threads();
+    printf("compositing a 3840x2160 view (%d threads)\n", threads);
+
+    static PaintContext ctx;
+    test_layers_(&ctx, 5);
+
+    // zoom, shrink
+    const int scales[][2] = { { 1, 1 }, { 3, 1 }, { 1, 4 } };
+    for (int k = 0; k < 3; ++k)
+    {
+        ctx.viewport.w = 3840;
+        ctx.viewport.h = 2160;
+        ctx.viewport.zoom = scales[k][0];
+        ctx.viewport.shrink = scales[k][1];
+        ctx.viewport.paint_x = -40;
+        ctx.viewport.paint_y = 10;
+
+        CcBitmap view = { .w = ctx.viewport.w, .h = ctx.viewport.h };
+        cc_bitmap_alloc(&view);
+
+        CcRect blocks;
+        CcRect out = cc_viewport_blocks(&ctx.viewport, cc_bitmap_rect(&view), &blocks);
+
+        CompositeJob job = {
+            .ctx = &ctx,
+            .blocks = blocks,
+            .dst = cc_bitmap_view(&view, out),
+            .zoom = ctx.viewport.zoom,
+        };
+        job.src = job.dst;
+
+        // the first frame builds the mips
+        prepare_composite_(&job);
+        composite_tiles_(&job, 0, job.tiles_w * job.tiles_h);
+
+        double start = seconds_();
+        for (int i = 0; i < frames; ++i)
+        {
+            prepare_composite_(&job);
+            composite_tiles_(&job, 0, job.tiles_w * job.tiles_h);
+        }
+        double serial = (seconds_() - start) / frames;
+        printf("zoom %d shrink %d: serial %.2f ms\n", ctx.viewport.zoom, ctx.viewport.shrink, serial * 1000.0);
+
+        for (int t = 1; t <= threads; ++t)
+        {
+            start = seconds_();
+            for (int i = 0; i < frames; ++i)
+            {
+                prepare_composite_(&job);
+                cc_parallel_for_threads(job.tiles_w * job.tiles_h, 2, t, composite_tiles_, &job);
+            }
+            double parallel = (seconds_() - start) / frames;
+            printf("  %2d threads %.2f ms, %.2fx\n", t, parallel * 1000.0, serial / parallel);
+        }
+
+        cc_bitmap_free(&view);
+    }
+
+    for (int i = 0; i < LAYER_COUNT; ++i)
+        cc_layer_shutdown(ctx.layers + i);
+}
@@ -126,8 +126,6 @@ typedef enum
 #define OS_PATH_MAX 2048
 
 enum {
-    LAYER_INTERMEDIATE,
-
     LAYER_MAIN,
     LAYER_OVERLAY,
     LAYER_COUNT
@@ -173,6 +171,9 @@ typedef struct
     int line_x;
     int line_y;
 
+    // spray can
+    CcRandom random;
+
     uint32_t fg_color;
     uint32_t bg_color;
     uint32_t view_bg_color;
@@ -183,6 +184,19 @@ typedef struct
     CcPolygon polygon;
     CcUndo undo;
 
+    // regions that changed since the last frame, in paint coordinates.
+    CcRect damage;
+    int damage_all;
+    // bounds of the tool preview currently drawn on the overlay.
+    CcRect preview_bounds;
+    // viewport of the last frame. any change to it redraws everything.
+    CcViewport damage_viewport;
+
+    // changed since paint_thumbnail last looked, in paint coordinates.
+    CcRect thumbnail_damage;
+    int thumbnail_damage_all;
+    int thumbnail_shrink;
+
     char open_file_path[OS_PATH_MAX];
 } PaintContext;
 
@@ -195,6 +209,8 @@ int paint_save_file_as(PaintContext* ctx, const char* path);
 int paint_save_file(PaintContext* ctx);
 
 int paint_init(PaintContext* ctx);
+// random tools (spray) repeat the same strokes for the same seed.
+void paint_seed_random(PaintContext* ctx, uint32_t seed);
 
 void paint_invert_colors(PaintContext* ctx);
 void paint_flip(PaintContext* ctx, int horiz);
@@ -217,7 +233,43 @@ int paint_h(const PaintContext* ctx);
 
 void paint_crop(PaintContext* ctx);
 
-void paint_composite(PaintContext* ctx, CcBitmap *composite);
+// Report that r (paint coordinates) needs to be redrawn.
+// Tools, undo and selections call this as they change pixels.
+void paint_damage(PaintContext* ctx, CcRect r);
+void paint_damage_all(PaintContext* ctx);
+
+// Call before paint_collect_damage. When the view only moved since the last frame,
+// returns 1 with the move (snapshot pixels) and damages just the uncovered strips.
+// What was on screen must then be moved by minus that much (times zoom).
+// Otherwise a moved view damages everything.
+int paint_collect_scroll(PaintContext* ctx, CcCoord* out_move);
+
+// Takes everything damaged since the last call, as a rect in viewport pixels.
+// Returns 0 when nothing on screen changed.
+int paint_collect_damage(PaintContext* ctx, CcRect* out_rect);
+
+// Overview of the image: LAYER_MAIN shrunk by the largest power of two
+// that keeps it at least w x h (as far as the mips go), so it can be sampled down to that.
+// Only what changed since the last call is filtered again,
+// out_changed gets that part in pixels of the returned bitmap (may be empty).
+// Returns NULL when there is no image.
+const CcBitmap* paint_thumbnail(PaintContext* ctx, int w, int h, CcRect* out_changed);
+
+// Called with each finished part (viewport pixels) of a composite,
+// e.g. to pack it into an image while it is still in cache.
+// Parts don't overlap and may come from several threads at once.
+typedef void (*CcCompositeDone)(void* ctx, CcRect r);
+
+// Compositing the view is done in two steps that may run on different threads.
+// paint_snapshot composites blocks (see cc_viewport_blocks) into snapshot,
+// which holds the whole view unzoomed (int_ceil(w, zoom) by int_ceil(h, zoom)).
+// Between mip levels it also resamples them to the view's fraction.
+// paint_zoom_snapshot draws the region (viewport pixels) of it into composite,
+// without touching the context. The region is grown to whole zoomed pixels.
+// filter (may be NULL) converts the result, see CcRowFilter.
+// done (may be NULL) is called as each part is written.
+void paint_snapshot(PaintContext* ctx, CcBitmap* snapshot, CcRect blocks);
+void paint_zoom_snapshot(const CcViewport* v, const CcBitmap* snapshot, CcBitmap* composite, CcRowFilter filter, CcCompositeDone done, void* done_ctx, CcRect region);
 
 void paint_copy(PaintContext* ctx);
 void paint_cut(PaintContext* ctx);
@@ -231,4 +283,8 @@ void paint_select_clear(PaintContext* ctx);
 void paint_set_color(PaintContext* ctx, uint32_t color, int fg);
 int paint_is_editing_text(PaintContext* ctx);
 
+void compositing_test(void);
+// prints how compositing scales with threads, see --bench
+void compositing_benchmark(void);
+
 #endif
@@ -0,0 +1,177 @@
+/* 
+ * Copyright (c) 2021 Justin Meiners
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include "parallel.h"
+
+#define PARALLEL_MAX_THREADS 16
+
+// Workers are started once and wait for jobs,
+// so a parallel_for costs a wake up rather than thread creation.
+// One job runs at a time. Callers that find the pool in use
+// (another thread, or a job inside a job) do their work serially.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+
+    int in_use;
+    unsigned generation;
+
+    CcParallelWork work;
+    void* ctx;
+    int n;
+    int bands;
+    int next_band;
+    int bands_left;
+} Pool;
+
+static
+Pool pool_ = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+static
+pthread_once_t pool_once_ = PTHREAD_ONCE_INIT;
+
+// the UI and render threads both ask, so it is counted once.
+static
+int threads_ = 1;
+static
+pthread_once_t threads_once_ = PTHREAD_ONCE_INIT;
+
+// Runs bands of the current job until none are left. Called with the lock held.
+static
+void run_bands_(Pool* pool)
+{
+    while (pool->next_band < pool->bands)
+    {
+        int i = pool->next_band++;
+        int start = (int)((int64_t)pool->n * i / pool->bands);
+        int end = (int)((int64_t)pool->n * (i + 1) / pool->bands);
+
+        CcParallelWork work = pool->work;
+        void* ctx = pool->ctx;
+
+        pthread_mutex_unlock(&pool->lock);
+        work(ctx, start, end);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->bands_left == 0)
+        {
+            pthread_cond_signal(&pool->done);
+        }
+    }
+}
+
+static
+void* worker_(void* arg)
+{
+    Pool* pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    unsigned seen = pool->generation;
+    while (1)
+    {
+        while (pool->generation == seen)
+        {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        seen = pool->generation;
+        run_bands_(pool);
+    }
+    return NULL;
+}
+
+static
+void start_workers_(void)
+{
+    // the calling thread is one of them.
+    // if a thread can't start, the others take its bands.
+    for (int i = 1; i < cc_parallel_threads(); ++i)
+    {
+        pthread_t id;
+        if (pthread_create(&id, NULL, worker_, &pool_) == 0)
+        {
+            pthread_detach(id);
+        }
+    }
+}
+
+static
+void count_threads_(void)
+{
+    long cpus = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    threads_ = (int)MAX(1, MIN(cpus, PARALLEL_MAX_THREADS));
+}
+
+int cc_parallel_threads(void)
+{
+    pthread_once(&threads_once_, count_threads_);
+    return threads_;
+}
+
+void cc_parallel_for(int n, int grain, CcParallelWork work, void* ctx)
+{
+    cc_parallel_for_threads(n, grain, cc_parallel_threads(), work, ctx);
+}
+
+void cc_parallel_for_threads(int n, int grain, int max_threads, CcParallelWork work, void* ctx)
+{
+    int threads = MIN(MIN(max_threads, cc_parallel_threads()), n / MAX(grain, 1));
+    if (threads <= 1)
+    {
+        if (n > 0) work(ctx, 0, n);
+        return;
+    }
+
+    pthread_once(&pool_once_, start_workers_);
+
+    Pool* pool = &pool_;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->in_use)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        work(ctx, 0, n);
+        return;
+    }
+
+    pool->in_use = 1;
+    pool->work = work;
+    pool->ctx = ctx;
+    pool->n = n;
+    pool->bands = threads;
+    pool->next_band = 0;
+    pool->bands_left = threads;
+    ++pool->generation;
+    pthread_cond_broadcast(&pool->start);
+
+    run_bands_(pool);
+    while (pool->bands_left > 0)
+    {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+
+    pool->in_use = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
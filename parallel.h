@@ -0,0 +1,34 @@
+/* 
+ * Copyright (c) 2021 Justin Meiners
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+
+// Does work(ctx, start, end) over [0, n), split into bands across threads.
+// Bands are at least grain long, so small jobs stay on the calling thread.
+// work must only touch its own band.
+// The threads are a pool started on first use.
+typedef void (*CcParallelWork)(void* ctx, int start, int end);
+
+void cc_parallel_for(int n, int grain, CcParallelWork work, void* ctx);
+// the same, on at most max_threads threads. For measuring how work scales.
+void cc_parallel_for_threads(int n, int grain, int max_threads, CcParallelWork work, void* ctx);
+
+int cc_parallel_threads(void);
+
+#endif
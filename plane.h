@@ -103,6 +103,30 @@ int cc_rect_equal(CcRect a, CcRect b)
     return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
 }
 
+static inline
+int cc_rect_empty(CcRect r)
+{
+    return r.w <= 0 || r.h <= 0;
+}
+
+// smallest rect holding both. empty rects add nothing.
+static inline
+CcRect cc_rect_union(CcRect a, CcRect b)
+{
+    if (cc_rect_empty(a)) return b;
+    if (cc_rect_empty(b)) return a;
+
+    int min_x = MIN(a.x, b.x);
+    int min_y = MIN(a.y, b.y);
+    int max_x = MAX(a.x + a.w, b.x + b.w);
+    int max_y = MAX(a.y + a.h, b.y + b.h);
+
+    CcRect result = {
+        min_x, min_y, max_x - min_x, max_y - min_y
+    };
+    return result;
+}
+
 static inline
 int cc_rect_contains(CcRect r, int x, int y)
 {
@@ -139,6 +163,13 @@ int int_ceil(int a, int b)
     return (a / b) + (a % b != 0);
 }
 
+// a / b rounded down, also when a is negative.
+static inline
+int int_floor(int a, int b)
+{
+    return (a / b) - (a % b < 0);
+}
+
 
 CcRect cc_rect_around_points(const CcCoord* points, int n);
 CcRect cc_rect_pad(CcRect r, int pad_w, int pad_h);
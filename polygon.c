@@ -341,7 +341,7 @@ void fill_polygon_(
         printf("\n");
         */
 
-        uint32_t* row_data = dst->data + dst->w * y;
+        uint32_t* row_data = cc_bitmap_row(dst, y);
 
         int i = 0;
         while (i + 1 < crossing_count)
@@ -0,0 +1,453 @@
+/* 
+ * Copyright (c) 2021 Justin Meiners
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include "transform.h"
+#include "parallel.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Separable resampling: scale every row, then every column.
+// Each output pixel along an axis is a weighted sum of a few input pixels.
+// Those weights only depend on the position, so they're computed once per axis.
+// https://entropymine.com/imageworsener/resample/
+
+// weights are fixed point, summing to 1 << WEIGHT_BITS.
+#define WEIGHT_BITS 14
+
+typedef struct
+{
+    int n;
+    int max_taps;
+    // output i reads count[i] pixels starting at start[i]
+    int *start;
+    int *count;
+    int16_t *weights;
+} WeightTable;
+
+static
+double filter_radius_(CcResample filter)
+{
+    switch (filter)
+    {
+        case RESAMPLE_BOX:
+            return 0.5;
+        case RESAMPLE_BILINEAR:
+            return 1.0;
+        case RESAMPLE_BICUBIC:
+            return 2.0;
+        case RESAMPLE_LANCZOS3:
+            return 3.0;
+        default:
+            return 0.0;
+    }
+}
+
+static
+double sinc_(double x)
+{
+    if (x == 0.0) return 1.0;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static
+double filter_eval_(CcResample filter, double x)
+{
+    x = fabs(x);
+    switch (filter)
+    {
+        case RESAMPLE_BOX:
+            return x <= 0.5 ? 1.0 : 0.0;
+        case RESAMPLE_BILINEAR:
+            return x < 1.0 ? 1.0 - x : 0.0;
+        case RESAMPLE_BICUBIC:
+            // Keys, a = -0.5 (Catmull-Rom)
+            if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+            if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+            return 0.0;
+        case RESAMPLE_LANCZOS3:
+            return x < 3.0 ? sinc_(x) * sinc_(x / 3.0) : 0.0;
+        default:
+            return 0.0;
+    }
+}
+
+// scale is output size / input size along this axis.
+// pixels past the edge repeat the edge.
+static
+void table_init_(WeightTable* t, int n_src, int n_dst, double scale, CcResample filter)
+{
+    double radius = filter_radius_(filter);
+    // shrinking stretches the filter so every input pixel is covered
+    double support = radius * MAX(1.0, 1.0 / scale);
+    double step = MIN(scale, 1.0);
+
+    t->n = n_dst;
+    t->max_taps = (int)ceil(support * 2.0) + 3;
+    t->start = malloc(sizeof(int) * n_dst * 2);
+    t->count = t->start + n_dst;
+    t->weights = calloc((size_t)n_dst * t->max_taps, sizeof(int16_t));
+
+    double *w = malloc(sizeof(double) * t->max_taps);
+
+    for (int i = 0; i < n_dst; ++i)
+    {
+        double center = ((double)i + 0.5) / scale;
+        int16_t *out = t->weights + (size_t)i * t->max_taps;
+
+        int lo = (int)floor(center - support);
+        int hi = (int)ceil(center + support);
+
+        int start = MIN(MAX(lo, 0), n_src - 1);
+        int end = MIN(MAX(hi, 0), n_src - 1);
+        int count = MIN(end - start + 1, t->max_taps);
+        for (int k = 0; k < count; ++k) w[k] = 0.0;
+
+        double sum = 0.0;
+        if (radius > 0.0)
+        {
+            for (int j = lo; j <= hi; ++j)
+            {
+                double x = ((double)j + 0.5 - center) * step;
+                double f = filter_eval_(filter, x);
+                int k = MIN(MAX(j, 0), n_src - 1) - start;
+                if (f == 0.0 || k < 0 || k >= count) continue;
+
+                w[k] += f;
+                sum += f;
+            }
+        }
+
+        if (sum == 0.0)
+        {
+            // nearest (or a filter too narrow to hit anything)
+            start = MIN(MAX((int)floor(center), 0), n_src - 1);
+            count = 1;
+            w[0] = sum = 1.0;
+        }
+
+        // round to fixed point, then give the leftover to the biggest weight
+        int total = 0;
+        int biggest = 0;
+        for (int k = 0; k < count; ++k)
+        {
+            out[k] = (int16_t)lround(w[k] / sum * (1 << WEIGHT_BITS));
+            total += out[k];
+            if (abs(out[k]) > abs(out[biggest])) biggest = k;
+        }
+        out[biggest] += (1 << WEIGHT_BITS) - total;
+
+        t->start[i] = start;
+        t->count[i] = count;
+    }
+
+    free(w);
+}
+
+static
+void table_free_(WeightTable* t)
+{
+    free(t->start);
+    free(t->weights);
+}
+
+static inline
+uint32_t to_channel_(int32_t acc)
+{
+    if (acc < 0) return 0;
+    acc = (acc + (1 << (WEIGHT_BITS - 1))) >> WEIGHT_BITS;
+    return (uint32_t)MIN(acc, 255);
+}
+
+// Colour is filtered premultiplied by alpha, like the mips (see average4_ in bitmap.c),
+// so clear pixels don't darken the edges of what is next to them.
+static inline
+CcPixel premultiply_(CcPixel p)
+{
+    uint32_t a = p >> COLOR_ALPHA_SHIFT;
+    if (a == 255) return p;
+
+    CcPixel out = a << COLOR_ALPHA_SHIFT;
+    for (int shift = 0; shift < 24; shift += 8)
+        out |= ((((p >> shift) & 0xFF) * a + 127) / 255) << shift;
+    return out;
+}
+
+static inline
+CcPixel unpremultiply_(CcPixel p)
+{
+    uint32_t a = p >> COLOR_ALPHA_SHIFT;
+    if (a == 255) return p;
+    if (a == 0) return COLOR_CLEAR;
+
+    CcPixel out = a << COLOR_ALPHA_SHIFT;
+    for (int shift = 0; shift < 24; shift += 8)
+    {
+        // sharpening filters can overshoot the alpha
+        uint32_t c = MIN((p >> shift) & 0xFF, a);
+        out |= ((c * 255 + a / 2) / a) << shift;
+    }
+    return out;
+}
+
+static
+void resample_row_(const CcPixel *restrict in, CcPixel *restrict out, const WeightTable* t)
+{
+    for (int i = 0; i < t->n; ++i)
+    {
+        const CcPixel *p = in + t->start[i];
+        const int16_t *w = t->weights + (size_t)i * t->max_taps;
+        int count = t->count[i];
+
+#if defined(__SSE2__)
+        // all four channels at once, two taps per multiply-add
+        __m128i zero = _mm_setzero_si128();
+        __m128i acc = zero;
+
+        int k = 0;
+        for (; k + 2 <= count; k += 2)
+        {
+            __m128i pair = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p + k)), zero);
+            __m128i mixed = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+            __m128i wv = _mm_set1_epi32((int32_t)((uint16_t)w[k] | ((uint32_t)(uint16_t)w[k + 1] << 16)));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(mixed, wv));
+        }
+        if (k < count)
+        {
+            __m128i single = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int32_t)p[k]), zero);
+            __m128i mixed = _mm_unpacklo_epi16(single, zero);
+            __m128i wv = _mm_set1_epi32((int32_t)(uint16_t)w[k]);
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(mixed, wv));
+        }
+
+        acc = _mm_srai_epi32(_mm_add_epi32(acc, _mm_set1_epi32(1 << (WEIGHT_BITS - 1))), WEIGHT_BITS);
+        acc = _mm_packs_epi32(acc, acc);
+        out[i] = (CcPixel)_mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+#else
+        CcPixel result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            int32_t acc = 0;
+            for (int k = 0; k < count; ++k)
+                acc += (int32_t)((p[k] >> shift) & 0xFF) * w[k];
+
+            result |= to_channel_(acc) << shift;
+        }
+        out[i] = result;
+#endif
+    }
+}
+
+// output row from rows[0..count) weighted by w, n pixels wide.
+static
+void resample_column_(const CcPixel **rows, const int16_t* w, int count, CcPixel *restrict out, int n)
+{
+    int x = 0;
+#if defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i round = _mm_set1_epi32(1 << (WEIGHT_BITS - 1));
+
+    for (; x + 4 <= n; x += 4)
+    {
+        __m128i acc[4] = { zero, zero, zero, zero };
+
+        for (int k = 0; k < count; k += 2)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+            __m128i b = zero;
+            int16_t wb = 0;
+            if (k + 1 < count)
+            {
+                b = _mm_loadu_si128((const __m128i *)(rows[k + 1] + x));
+                wb = w[k + 1];
+            }
+            __m128i wv = _mm_set1_epi32((int32_t)((uint16_t)w[k] | ((uint32_t)(uint16_t)wb << 16)));
+
+            __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+            __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+            __m128i b_lo = _mm_unpacklo_epi8(b, zero);
+            __m128i b_hi = _mm_unpackhi_epi8(b, zero);
+
+            acc[0] = _mm_add_epi32(acc[0], _mm_madd_epi16(_mm_unpacklo_epi16(a_lo, b_lo), wv));
+            acc[1] = _mm_add_epi32(acc[1], _mm_madd_epi16(_mm_unpackhi_epi16(a_lo, b_lo), wv));
+            acc[2] = _mm_add_epi32(acc[2], _mm_madd_epi16(_mm_unpacklo_epi16(a_hi, b_hi), wv));
+            acc[3] = _mm_add_epi32(acc[3], _mm_madd_epi16(_mm_unpackhi_epi16(a_hi, b_hi), wv));
+        }
+
+        for (int i = 0; i < 4; ++i)
+            acc[i] = _mm_srai_epi32(_mm_add_epi32(acc[i], round), WEIGHT_BITS);
+
+        __m128i lo = _mm_packs_epi32(acc[0], acc[1]);
+        __m128i hi = _mm_packs_epi32(acc[2], acc[3]);
+        _mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; x < n; ++x)
+    {
+        CcPixel result = 0;
+        for (int shift = 0; shift < 32; shift += 8)
+        {
+            int32_t acc = 0;
+            for (int k = 0; k < count; ++k)
+                acc += (int32_t)((rows[k][x] >> shift) & 0xFF) * w[k];
+
+            result |= to_channel_(acc) << shift;
+        }
+        out[x] = result;
+    }
+}
+
+typedef struct
+{
+    const CcBitmap* src;
+    CcBitmap* dst;
+    const WeightTable* table;
+} ResampleJob;
+
+static
+void horizontal_rows_(void* ctx, int start, int end)
+{
+    const ResampleJob* job = ctx;
+    int w = job->src->w;
+    CcPixel *premultiplied = malloc(sizeof(CcPixel) * w);
+
+    for (int y = start; y < end; ++y)
+    {
+        const CcPixel *in = cc_bitmap_row(job->src, y);
+        for (int x = 0; x < w; ++x)
+            premultiplied[x] = premultiply_(in[x]);
+
+        resample_row_(premultiplied, cc_bitmap_row(job->dst, y), job->table);
+    }
+
+    free(premultiplied);
+}
+
+static
+void vertical_rows_(void* ctx, int start, int end)
+{
+    const ResampleJob* job = ctx;
+    const WeightTable* t = job->table;
+
+    const CcPixel **rows = malloc(sizeof(CcPixel *) * t->max_taps);
+
+    for (int y = start; y < end; ++y)
+    {
+        for (int k = 0; k < t->count[y]; ++k)
+            rows[k] = cc_bitmap_row(job->src, t->start[y] + k);
+
+        resample_column_(
+                rows,
+                t->weights + (size_t)y * t->max_taps,
+                t->count[y],
+                cc_bitmap_row(job->dst, y),
+                job->dst->w
+                );
+
+        CcPixel *out = cc_bitmap_row(job->dst, y);
+        for (int x = 0; x < job->dst->w; ++x)
+            out[x] = unpremultiply_(out[x]);
+    }
+
+    free(rows);
+}
+
+CcBitmap cc_bitmap_resample_scale(const CcBitmap* src, int w, int h, double sx, double sy, CcResample filter)
+{
+    assert(w > 0 && h > 0);
+    assert(src->w > 0 && src->h > 0);
+
+    WeightTable columns;
+    WeightTable rows;
+    table_init_(&columns, src->w, w, sx, filter);
+    table_init_(&rows, src->h, h, sy, filter);
+
+    CcBitmap wide = {
+        .w = w,
+        .h = src->h
+    };
+    cc_bitmap_alloc(&wide);
+
+    ResampleJob job = { src, &wide, &columns };
+    cc_parallel_for(src->h, 16, horizontal_rows_, &job);
+
+    CcBitmap dst = {
+        .w = w,
+        .h = h
+    };
+    cc_bitmap_alloc(&dst);
+
+    job = (ResampleJob) { &wide, &dst, &rows };
+    cc_parallel_for(h, 16, vertical_rows_, &job);
+
+    cc_bitmap_free(&wide);
+    table_free_(&columns);
+    table_free_(&rows);
+    return dst;
+}
+
+CcBitmap cc_bitmap_resample(const CcBitmap* src, int w, int h, CcResample filter)
+{
+    return cc_bitmap_resample_scale(
+            src,
+            w, h,
+            (double)w / (double)src->w,
+            (double)h / (double)src->h,
+            filter
+            );
+}
+
+void resample_test(void)
+{
+    printf("testing resampling\n");
+
+    // red on the left, clear on the right
+    CcBitmap src = { .w = 8, .h = 4 };
+    cc_bitmap_alloc(&src);
+    for (int y = 0; y < src.h; ++y)
+    {
+        CcPixel *row = cc_bitmap_row(&src, y);
+        for (int x = 0; x < src.w; ++x)
+            row[x] = x < 5 ? COLOR_RED : COLOR_CLEAR;
+    }
+
+    const CcResample filters[] = { RESAMPLE_BOX, RESAMPLE_BILINEAR, RESAMPLE_BICUBIC, RESAMPLE_LANCZOS3 };
+    for (int i = 0; i < 4; ++i)
+    {
+        CcBitmap dst = cc_bitmap_resample(&src, 4, 2, filters[i]);
+
+        // the edge is partly clear
+        uint32_t alpha = cc_bitmap_row(&dst, 0)[2] >> COLOR_ALPHA_SHIFT;
+        assert(alpha > 0 && alpha < 255);
+
+        // but everything that shows is still the same red, without a dark fringe.
+        for (int y = 0; y < dst.h; ++y)
+        {
+            for (int x = 0; x < dst.w; ++x)
+            {
+                CcPixel p = cc_bitmap_row(&dst, y)[x];
+                assert(p == COLOR_CLEAR || (p & ~COLOR_ALPHA_MASK) == (COLOR_RED & ~COLOR_ALPHA_MASK));
+            }
+        }
+
+        cc_bitmap_free(&dst);
+    }
+
+    cc_bitmap_free(&src);
+}
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include "transform.h"
+#include "parallel.h"
 
 CcTransform cc_transform_inverse(CcTransform t)
 {
@@ -39,7 +40,192 @@ CcTransform cc_transform_concat(CcTransform a, CcTransform b)
     return t;
 }
 
-CcBitmap cc_bitmap_transform(const CcBitmap* src, CcTransform A, uint32_t bg_color)
+// Preimages are stepped across each row in 32.32 fixed point.
+// Only the start of each row comes from floating point, so error can't build up between rows.
+#define FIX_BITS 32
+#define FIX_ONE ((int64_t)1 << FIX_BITS)
+
+// Stretching by 211% puts pixel 105 exactly on source pixel 50 (105.5 / 2.11).
+// Rounding in dx can land just short of that, so nudge preimages up
+// by more than the drift across a row can ever be.
+#define FIX_NUDGE (FIX_ONE >> 16)
+
+typedef struct
+{
+    const CcBitmap* src;
+    CcBitmap* dst;
+    CcTransform inverse;
+    Vec2 min;
+    CcPixel bg_color;
+    CcResample filter;
+} TransformJob;
+
+static inline
+int64_t to_fix_(double x)
+{
+    return (int64_t)llround(x * (double)FIX_ONE);
+}
+
+static inline
+int fix_floor_(int64_t x)
+{
+    return (int)(x >= 0 ? x >> FIX_BITS : -((-x - 1) >> FIX_BITS) - 1);
+}
+
+// [lo, hi) of x where floor(u0 + x du) is in [0, max].
+// Generous, it's tightened afterwards.
+static
+void solve_span_(int64_t u0, int64_t du, int max, double* lo, double* hi)
+{
+    double u = (double)u0 / FIX_ONE;
+    double d = (double)du / FIX_ONE;
+
+    if (d == 0.0)
+    {
+        if (u >= 0.0 && u < max + 1.0)
+        {
+            *lo = -HUGE_VAL;
+            *hi = HUGE_VAL;
+        }
+        else
+        {
+            *lo = *hi = 0.0;
+        }
+        return;
+    }
+
+    double t1 = -u / d;
+    double t2 = (max + 1.0 - u) / d;
+    *lo = floor(MIN(t1, t2)) - 1.0;
+    *hi = ceil(MAX(t1, t2)) + 2.0;
+}
+
+static inline
+int inside_(int64_t fx, int64_t fy, int max_x, int max_y)
+{
+    int x = fix_floor_(fx);
+    int y = fix_floor_(fy);
+    return x >= 0 && y >= 0 && x <= max_x && y <= max_y;
+}
+
+static inline
+CcPixel bilinear_(CcPixel p00, CcPixel p10, CcPixel p01, CcPixel p11, uint32_t wx, uint32_t wy)
+{
+    CcPixel out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t top = ((p00 >> shift) & 0xFF) * (256 - wx) + ((p10 >> shift) & 0xFF) * wx;
+        uint32_t bottom = ((p01 >> shift) & 0xFF) * (256 - wx) + ((p11 >> shift) & 0xFF) * wx;
+        uint32_t c = (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16;
+        out |= c << shift;
+    }
+    return out;
+}
+
+// fractional part as 8 bits
+static inline
+uint32_t fix_weight_(int64_t x)
+{
+    return (uint32_t)((x >> (FIX_BITS - 8)) & 0xFF);
+}
+
+static inline
+CcPixel sample_checked_(const TransformJob* job, int64_t fx, int64_t fy)
+{
+    int x = fix_floor_(fx);
+    int y = fix_floor_(fy);
+    const CcBitmap* src = job->src;
+    CcPixel bg = job->bg_color;
+
+    if (job->filter != RESAMPLE_NEAREST)
+    {
+        return bilinear_(
+                cc_bitmap_get(src, x, y, bg),
+                cc_bitmap_get(src, x + 1, y, bg),
+                cc_bitmap_get(src, x, y + 1, bg),
+                cc_bitmap_get(src, x + 1, y + 1, bg),
+                fix_weight_(fx),
+                fix_weight_(fy)
+                );
+    }
+    else
+    {
+        return cc_bitmap_get(src, x, y, bg);
+    }
+}
+
+static
+void transform_rows_(void* ctx, int start, int end)
+{
+    const TransformJob* job = ctx;
+    const CcBitmap* src = job->src;
+    CcBitmap* dst = job->dst;
+
+    // bilinear reads a 2x2 block whose corner is half a pixel up and left.
+    int bilinear = job->filter != RESAMPLE_NEAREST;
+    double bias = bilinear ? 0.5 : 0.0;
+    int max_x = src->w - (bilinear ? 2 : 1);
+    int max_y = src->h - (bilinear ? 2 : 1);
+
+    int64_t dx = to_fix_(job->inverse.m[0]);
+    int64_t dy = to_fix_(job->inverse.m[2]);
+
+    for (int y = start; y < end; ++y)
+    {
+        // center pixels
+        Vec2 image = { job->min.x + 0.5, job->min.y + (double)y + 0.5 };
+        Vec2 pre_image = cc_transform_apply(job->inverse, image);
+
+        int64_t fx = to_fix_(pre_image.x - bias) + FIX_NUDGE;
+        int64_t fy = to_fix_(pre_image.y - bias) + FIX_NUDGE;
+
+        // split the row into edges (bounds checked) and an interior (not).
+        int a = 0;
+        int b = 0;
+        if (max_x >= 0 && max_y >= 0)
+        {
+            double lo_x, hi_x, lo_y, hi_y;
+            solve_span_(fx, dx, max_x, &lo_x, &hi_x);
+            solve_span_(fy, dy, max_y, &lo_y, &hi_y);
+
+            a = (int)MIN(MAX(MAX(lo_x, lo_y), 0.0), (double)dst->w);
+            b = (int)MAX(MIN(MIN(hi_x, hi_y), (double)dst->w), (double)a);
+
+            while (a < b && !inside_(fx + a * dx, fy + a * dy, max_x, max_y)) ++a;
+            while (b > a && !inside_(fx + (b - 1) * dx, fy + (b - 1) * dy, max_x, max_y)) --b;
+        }
+
+        CcPixel *restrict out = cc_bitmap_row(dst, y);
+
+        for (int x = 0; x < a; ++x)
+            out[x] = sample_checked_(job, fx + x * dx, fy + x * dy);
+
+        int64_t ux = fx + a * dx;
+        int64_t uy = fy + a * dy;
+
+        if (bilinear)
+        {
+            for (int x = a; x < b; ++x, ux += dx, uy += dy)
+            {
+                const CcPixel *top = cc_bitmap_row(src, (int)(uy >> FIX_BITS)) + (ux >> FIX_BITS);
+                const CcPixel *bottom = (const CcPixel *)((const char *)top + src->stride);
+                out[x] = bilinear_(top[0], top[1], bottom[0], bottom[1], fix_weight_(ux), fix_weight_(uy));
+            }
+        }
+        else
+        {
+            for (int x = a; x < b; ++x, ux += dx, uy += dy)
+            {
+                out[x] = cc_bitmap_row(src, (int)(uy >> FIX_BITS))[ux >> FIX_BITS];
+            }
+        }
+
+        for (int x = b; x < dst->w; ++x)
+            out[x] = sample_checked_(job, fx + x * dx, fy + x * dy);
+    }
+}
+
+CcBitmap cc_bitmap_transform(const CcBitmap* src, CcTransform A, uint32_t bg_color, CcResample filter)
 {
     double epsilon = 0.0001;
     Vec2 corners[4];
@@ -80,37 +266,26 @@ CcBitmap cc_bitmap_transform(const CcBitmap* src, CcTransform A, uint32_t bg_col
         .h = (int)(max.y - min.y)
     };
 
-    cc_bitmap_alloc(&dst);
+    int pure_scale = A.m[1] == 0.0 && A.m[2] == 0.0 && A.m[0] > 0.0 && A.m[3] > 0.0;
+    if (pure_scale && filter != RESAMPLE_NEAREST && dst.w > 0 && dst.h > 0 && src->w > 0 && src->h > 0)
+    {
+        return cc_bitmap_resample_scale(src, dst.w, dst.h, A.m[0], A.m[3], filter);
+    }
 
-    uint32_t *restrict out = dst.data;
+    cc_bitmap_alloc(&dst);
 
     // A: R^n -> R^m
     // Iterate each pixel in the destination
     // and find it's preimage under A to know its previous color.
-    CcTransform inverse = cc_transform_inverse(A);
-
-    // center pixels
-
-    for (int y = 0; y < dst.h; ++y)
-    {
-        for (int x = 0; x < dst.w; ++x)
-        {
-            Vec2 image;
-            image.x = min.x + (double)x + 0.5;
-            image.y = min.y + (double)y + 0.5;
-
-            // I explored adding the derivative instead of transforming each time.
-            // but, lots of small additions accumlate error and this isn't a big deal for a 2x2 matrix.
-            Vec2 pre_image = cc_transform_apply(inverse, image);
-
-            int src_x = (int)floor(pre_image.x);
-            int src_y = (int)floor(pre_image.y);
+    TransformJob job = {
+        .src = src,
+        .dst = &dst,
+        .inverse = cc_transform_inverse(A),
+        .min = min,
+        .bg_color = bg_color,
+        .filter = filter
+    };
 
-            //printf("image: %f, %f pre: %f, %f\n", image.x, image.y, pre_image.x, pre_image.y);
-            *out = cc_bitmap_get(src, src_x, src_y, bg_color);
-            ++out;
-        }
-    }
+    cc_parallel_for(dst.h, 16, transform_rows_, &job);
     return dst;
 }
-
@@ -82,7 +82,30 @@ CcTransform cc_transform_inverse(CcTransform t);
 CcTransform cc_transform_skew(double x_angle, double y_angle);
 CcTransform cc_transform_concat(CcTransform a, CcTransform b);
 
-CcBitmap cc_bitmap_transform(const CcBitmap* src, CcTransform A, uint32_t bg_color);
+typedef enum
+{
+    // keeps hard pixel edges
+    RESAMPLE_NEAREST,
+    // smooth, reads the 4 closest pixels
+    RESAMPLE_BILINEAR,
+    // average of the covered pixels
+    RESAMPLE_BOX,
+    RESAMPLE_BICUBIC,
+    RESAMPLE_LANCZOS3,
+} CcResample;
+
+// pixels mapped from outside of src are bg_color.
+// Pure scales go through cc_bitmap_resample_scale (except nearest).
+// Otherwise filters other than nearest are treated as bilinear.
+CcBitmap cc_bitmap_transform(const CcBitmap* src, CcTransform A, uint32_t bg_color, CcResample filter);
+
+// Scale src to w, h with a separable filter.
+// When shrinking, the filter widens to cover all of src, so there is no aliasing.
+CcBitmap cc_bitmap_resample(const CcBitmap* src, int w, int h, CcResample filter);
+// same, with the scale of each axis given separately from the size of the result.
+CcBitmap cc_bitmap_resample_scale(const CcBitmap* src, int w, int h, double sx, double sy, CcResample filter);
+
+void resample_test(void);
 
 #endif
 
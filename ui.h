@@ -56,8 +56,12 @@ void ui_setup_view_menu(Widget menubar);
 
 Widget ui_setup_tool_area(Widget parent);
 Widget ui_setup_command_area(Widget parent);
+Widget ui_setup_navigator(Widget parent);
 
 void ui_refresh_drawing(int clear);
+void ui_refresh_navigator(void);
+// scrolls so (x, y) (paint coordinates) is in the middle of the view
+void ui_center_view(int x, int y);
 void ui_drawing_cleanup(void);
 
 Widget ui_start_editing_text(void);
@@ -70,7 +74,31 @@ void ui_refresh_tool(void);
 void ui_refresh_title(void);
 XtAppContext ui_app();
 
-XImage *cc_bitmap_create_ximage(CcBitmap *b, Display *display, Visual *visual);
-void cc_bitmap_swap_for_xvisual(CcBitmap *b, const XVisualInfo *info);
+// Pixel layout of a TrueColor/DirectColor visual, found once from its masks.
+// channels are R, G, B.
+typedef struct
+{
+    int bytes_per_pixel;
+    int shift[3];
+    int bits[3];
+    // ordered dither when a channel has fewer than 8 bits
+    int dither;
+} CcXFormat;
+
+// returns 0 for layouts we can't draw (16 or 32 bits per pixel only).
+int cc_xformat_init(CcXFormat* format, const XVisualInfo* info, int bits_per_pixel);
+
+XImage *cc_create_ximage(Display *display, Visual *visual, int depth, const CcXFormat* format, int w, int h);
+
+// 4 byte formats: converts our pixels in place. NULL when they already match.
+// Other layouts need the format set first with cc_row_filter_set_xformat.
+CcRowFilter cc_row_filter_for_xformat(const CcXFormat* format);
+// the format the filters convert to. Set it once, before any thread draws.
+void cc_row_filter_set_xformat(const CcXFormat* format);
+// 2 byte formats: converts rect r of src into the same rect of dst.
+void cc_bitmap_pack_ximage(const CcBitmap* src, XImage* dst, CcRect r, const CcXFormat* format);
+
+// layout of the default visual, which the drawing area uses.
+const CcXFormat* ui_draw_format(void);
 
 #endif
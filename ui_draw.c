@@ -15,6 +15,8 @@
  */
 
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "ui.h"
 
 // UGLY CODE
@@ -29,29 +31,106 @@
 #include <X11/extensions/XShm.h>
 #endif
 
+#ifdef FEATURE_XRENDER
+// https://www.x.org/releases/X11R7.7/doc/libXrender/libXrender.txt
+#include <X11/extensions/Xrender.h>
+#endif
+
 #include <Xm/DrawingA.h>
 #include <Xm/ScrollBar.h>
 #include <Xm/ScrolledW.h>
 
+// What the render thread needs to draw a frame.
 typedef struct
 {
+    Window window;
+    CcViewport viewport;
+    // changed part of the snapshot (viewport pixels)
+    CcRect damage;
+    // what is on screen moves by minus this (viewport pixels) first
+    CcCoord scroll;
+    // the window lost these pixels (viewport pixels)
+    CcRect expose;
+    // outline of the selection (viewport pixels), empty for none
+    CcRect selection;
+} RenderJob;
+
+// Frames are composited into a snapshot on the UI thread, which is cheap
+// (one blend at canvas scale). The render thread does the rest:
+// zooming, converting for the visual and uploading, so input doesn't wait on it.
+//
+// The render thread has its own connection to the server,
+// so neither needs XInitThreads. Everything below the lock is shared.
+typedef struct
+{
+    Display* dpy;
     int use_shm;
+    int shm_event;
 
     Visual* x_visual;
     GC x_gc;
     XVisualInfo x_visual_info;
+    CcXFormat x_format;
     XColor select_bright;
     XColor select_dark;
 
     XImage* x_image;
 
+    // the buffer to draw next. the other may still be read by the server.
     size_t shm_index;
     XImage *shm_image[2];
+    // put, but no ShmCompletion yet
+    int shm_busy[2];
+
+    // 2 byte formats composite here, then pack into the image.
+    CcBitmap staging;
+
+    // Without shm every upload crosses the connection, which may be a network.
+    // The server keeps a copy of the frame in mirror, so exposes and scrolls
+    // are redrawn from it and only new pixels are sent.
+    Pixmap mirror;
+    // copies between drawables we own never need GraphicsExpose
+    GC copy_gc;
 
 #ifdef FEATURE_SHM
     // "it will have a lifetime at least as long as that of the ... XImage"
     XShmSegmentInfo shminfo;
 #endif
+
+#ifdef FEATURE_XRENDER
+    // When zoomed in, the snapshot goes to the server as it is (zoom^2 fewer pixels)
+    // and the server scales it into the window.
+    int use_xrender;
+    Pixmap scaled_src;
+    int scaled_src_w;
+    int scaled_src_h;
+    Picture scaled_src_pict;
+    // zoom the source holds a current copy for, 0 for none
+    int scaled_zoom;
+    // picture of the window or the mirror
+    Drawable scaled_dst;
+    Picture scaled_dst_pict;
+#endif
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int quit;
+
+    // The render thread has a job or is drawing one.
+    // Only it may touch the snapshot until this clears.
+    int busy;
+    int job_ready;
+    RenderJob job;
+    CcBitmap snapshot;
+
+    // A refresh came while busy. The render thread wakes
+    // the UI thread through the pipe to do it.
+    int deferred;
+    int notify[2];
+
+    // UI thread only. exposes waiting for the next job.
+    CcRect exposed;
 } DrawInfo;
 
 
@@ -71,8 +150,8 @@ void update_scroll_(void)
     int max_w = paint_w(ctx) + draw_padding;
     int max_h = paint_h(ctx) + draw_padding;
 
-    int h_slider_size = MIN(ctx->viewport.w / ctx->viewport.zoom, max_w);
-    int v_slider_size = MIN(ctx->viewport.h / ctx->viewport.zoom, max_h);
+    int h_slider_size = MIN(cc_viewport_paint_w(&ctx->viewport), max_w);
+    int v_slider_size = MIN(cc_viewport_paint_h(&ctx->viewport), max_h);
 
     ctx->viewport.paint_x = MAX(ctx->viewport.paint_x, 0);
     ctx->viewport.paint_y = MAX(ctx->viewport.paint_y, 0);
@@ -91,14 +170,14 @@ void update_scroll_(void)
     XtSetArg(args[n], XmNvalue, ctx->viewport.paint_x); ++n;
     XtSetArg(args[n], XmNmaximum, max_w); ++n;
     XtSetArg(args[n], XmNsliderSize, h_slider_size); ++n;
-    XtSetArg(args[n], XmNincrement, 8); ++n;
+    XtSetArg(args[n], XmNincrement, 8 * ctx->viewport.shrink); ++n;
     XtSetValues(hsb, args, n);
 
     n = 0;
     XtSetArg(args[n], XmNvalue, ctx->viewport.paint_y); ++n;
     XtSetArg(args[n], XmNmaximum, max_h); ++n;
     XtSetArg(args[n], XmNsliderSize, v_slider_size); ++n;
-    XtSetArg(args[n], XmNincrement, 8); ++n;
+    XtSetArg(args[n], XmNincrement, 8 * ctx->viewport.shrink); ++n;
     XtSetValues(vsb, args, n);
 }
 
@@ -121,6 +200,40 @@ void resize_view_(void)
     ctx->viewport.h = view_h;
 }
 
+// Input can come much faster than the display shows frames (1000 Hz mice).
+// The first redraw goes out right away, more requests within the
+// same frame are batched into one when it ends.
+static
+const unsigned long frame_interval_ = 16;
+
+static
+XtIntervalId frame_timer_ = 0;
+static
+int frame_requested_ = 0;
+
+static
+void fire_frame_timer_(XtPointer client_data, XtIntervalId* id)
+{
+    frame_timer_ = 0;
+    if (frame_requested_)
+    {
+        frame_requested_ = 0;
+        ui_refresh_drawing(0);
+        frame_timer_ = XtAppAddTimeOut(ui_app(), frame_interval_, fire_frame_timer_, NULL);
+    }
+}
+
+static
+void schedule_redraw_(void)
+{
+    if (frame_timer_ != 0) {
+        frame_requested_ = 1;
+        return;
+    }
+    ui_refresh_drawing(0);
+    frame_timer_ = XtAppAddTimeOut(ui_app(), frame_interval_, fire_frame_timer_, NULL);
+}
+
 static
 void schedule_hold_down_timer_(Time time_interval, PaintTool tool);
 
@@ -133,7 +246,7 @@ void fire_hold_down_timer_(XtPointer client_data, XtIntervalId* id)
     if (tool == ctx->tool && ctx->request_tool_timer)
     {
         paint_tool_update(ctx);
-        ui_refresh_drawing(0);
+        schedule_redraw_();
 
         const Time hold_update = 25;
         schedule_hold_down_timer_(hold_update, tool);
@@ -150,7 +263,9 @@ void schedule_hold_down_timer_(Time time_interval, PaintTool tool)
             XtRemoveTimeOut(timer);
             timer = 0;
         }
+        // fire schedules the next one
         fire_hold_down_timer_((XtPointer)tool, &timer);
+        return;
     }
 
     timer = XtAppAddTimeOut(ui_app(), time_interval, fire_hold_down_timer_, (XtPointer)tool);
@@ -208,14 +323,8 @@ void ui_cb_draw_input_(Widget scrollbar, XtPointer client_data, XtPointer call_d
         }
         case MotionNotify:
         {
-            // limit framerate to avoid maxing CPU unnecessarily
-            const Time min_time_between_frames = 15;
-
-            static Time previous_notify_time = 0;
-            if (event->xmotion.time < previous_notify_time + min_time_between_frames) break;
-
-            previous_notify_time = event->xmotion.time;
-
+            // every point goes to the tool so strokes follow the mouse,
+            // redraws are limited to one a frame below.
             ctx->tool_force_align = (event->xbutton.state & ShiftMask);
 
             cc_viewport_coord_to_paint(&ctx->viewport, event->xmotion.x, event->xmotion.y, &x, &y);
@@ -241,9 +350,49 @@ void ui_cb_draw_input_(Widget scrollbar, XtPointer client_data, XtPointer call_d
         ui_set_color(g_main_w, ctx->fg_color, 1);
         ui_set_color(g_main_w, ctx->bg_color, 0);
     }
+    schedule_redraw_();
+}
+
+static
+void ui_cb_draw_expose_(Widget widget, XtPointer client_data, XtPointer call_data)
+{
+    if (!g_ready) {
+        return;
+    }
+
+    XmDrawingAreaCallbackStruct *cbs = (XmDrawingAreaCallbackStruct*)call_data;
+    XEvent* event = cbs->event;
+
+    // the view and the snapshot are still good, the render thread
+    // just has to show them again.
+    CcRect r = { 0, 0, g_paint_ctx.viewport.w, g_paint_ctx.viewport.h };
+    if (event && event->type == Expose)
+    {
+        r = (CcRect) { event->xexpose.x, event->xexpose.y, event->xexpose.width, event->xexpose.height };
+    }
+    g_draw_info.exposed = cc_rect_union(g_draw_info.exposed, r);
+
+    resize_view_();
+    update_scroll_();
     ui_refresh_drawing(0);
 }
 
+void ui_center_view(int x, int y)
+{
+    CcViewport* v = &g_paint_ctx.viewport;
+    v->paint_x = x - cc_viewport_paint_w(v) / 2;
+    v->paint_y = y - cc_viewport_paint_h(v) / 2;
+
+    // keeps it in bounds
+    update_scroll_();
+    schedule_redraw_();
+}
+
+const CcXFormat* ui_draw_format(void)
+{
+    return &g_draw_info.x_format;
+}
+
 void ui_cb_draw_update(Widget scrollbar, XtPointer client_data, XtPointer call_data)
 {
     if (!g_ready) {
@@ -256,7 +405,7 @@ void ui_cb_draw_update(Widget scrollbar, XtPointer client_data, XtPointer call_d
 }
 
 static
-int verify_visual_(Display* display, const Visual* visual, XVisualInfo* out_info)
+int verify_visual_(Display* display, const Visual* visual, XVisualInfo* out_info, CcXFormat* out_format)
 {
     int visual_count;
     XVisualInfo template;
@@ -266,13 +415,15 @@ int verify_visual_(Display* display, const Visual* visual, XVisualInfo* out_info
     XVisualInfo* info_list = XGetVisualInfo (display, VisualIDMask, &template, &visual_count);
     assert(visual_count == 1);
 
-    // 24 or 32 bit depth
-    if (info_list->depth != 24 && info_list->depth != 32)
+    // depth is only the used bits, the pixmap format says how big pixels are.
+    int bits_per_pixel = 0;
+    int format_count;
+    XPixmapFormatValues* formats = XListPixmapFormats(display, &format_count);
+    for (int i = 0; i < format_count; ++i)
     {
-        fprintf(stderr, "XVisual has invalid depth: %d\n", info_list->depth);
-        XFree(info_list);
-        return 0;
+        if (formats[i].depth == info_list->depth) bits_per_pixel = formats[i].bits_per_pixel;
     }
+    if (formats) XFree(formats);
 
     // This check for bits_per_rgb does not provide the expected value.
     // if (info_list->bits_per_rgb != 8)
@@ -286,11 +437,27 @@ int verify_visual_(Display* display, const Visual* visual, XVisualInfo* out_info
         return 0;
     }
 
+    // 15, 16, 24, 30 or 32 bit depth
+    if (!cc_xformat_init(out_format, info_list, bits_per_pixel))
+    {
+        fprintf(stderr, "XVisual has invalid depth: %d (%d bpp)\n", info_list->depth, bits_per_pixel);
+        XFree(info_list);
+        return 0;
+    }
+
+    // before the render thread starts, the filters only read it after this.
+    cc_row_filter_set_xformat(out_format);
+
     *out_info = info_list[0];
     XFree(info_list);
     return 1;
 }
 
+static
+void* render_main_(void* arg);
+static
+void render_done_(XtPointer client_data, int* fd, XtInputId* id);
+
 Widget ui_setup_draw_area(Widget parent)
 {
     DrawInfo* buffer = &g_draw_info;
@@ -319,34 +486,69 @@ Widget ui_setup_draw_area(Widget parent)
 
     // not working for some reason
     XtAddCallback(draw_area, XmNinputCallback, ui_cb_draw_input_, NULL);
-    XtAddCallback(draw_area, XmNexposeCallback, ui_cb_draw_update, NULL);
+    XtAddCallback(draw_area, XmNexposeCallback, ui_cb_draw_expose_, NULL);
     XtAddCallback(draw_area, XmNresizeCallback, ui_cb_draw_update, NULL);
 
     Display* display = XtDisplay(draw_area);
 
+    // the render thread's connection. Windows and colors are shared by all clients.
+    buffer->dpy = XOpenDisplay(DisplayString(display));
+    if (!buffer->dpy)
+    {
+        fprintf(stderr, "failed to open a display for rendering\n");
+        exit(1);
+    }
+
     XGCValues gcv;
     gcv.foreground = BlackPixelOfScreen(XtScreen(draw_area));
-    buffer->x_gc = XCreateGC(display, RootWindowOfScreen(XtScreen(draw_area)), GCForeground, &gcv);
+    buffer->x_gc = XCreateGC(buffer->dpy, RootWindow(buffer->dpy, DefaultScreen(buffer->dpy)), GCForeground, &gcv);
+
+    gcv.graphics_exposures = False;
+    buffer->copy_gc = XCreateGC(buffer->dpy, RootWindow(buffer->dpy, DefaultScreen(buffer->dpy)), GCGraphicsExposures, &gcv);
 
     // about visuals
     // https://docs.oracle.com/cd/E19620-01/805-3921/6j3nm4qiu/index.html
  
     // We don't need to pick a visual. It is provided by motif.
     // Just verify it's sane.
-    g_draw_info.x_visual = DefaultVisual(display, 0);
+    g_draw_info.x_visual = DefaultVisual(buffer->dpy, 0);
 
-    if (!verify_visual_(display, g_draw_info.x_visual, &g_draw_info.x_visual_info))
+    if (!verify_visual_(buffer->dpy, g_draw_info.x_visual, &g_draw_info.x_visual_info, &g_draw_info.x_format))
     {
         exit(1);
     }
 
 #ifdef FEATURE_SHM
     buffer->x_image = NULL;
-    buffer->use_shm = XShmQueryExtension(display) == True;
+    buffer->use_shm = XShmQueryExtension(buffer->dpy) == True;
+    if (buffer->use_shm)
+    {
+        buffer->shm_event = XShmGetEventBase(buffer->dpy) + ShmCompletion;
+    }
 #else
     buffer->use_shm = 0;
 #endif
 
+#ifdef FEATURE_XRENDER
+    // transforms and filters came in version 0.6
+    int render_event, render_error;
+    int render_major = 0, render_minor = 0;
+    buffer->use_xrender = XRenderQueryExtension(buffer->dpy, &render_event, &render_error)
+        && XRenderQueryVersion(buffer->dpy, &render_major, &render_minor)
+        && (render_major > 0 || render_minor >= 6)
+        && XRenderFindVisualFormat(buffer->dpy, buffer->x_visual) != NULL;
+#endif
+
+    pthread_mutex_init(&buffer->lock, NULL);
+    pthread_cond_init(&buffer->wake, NULL);
+
+    if (pipe(buffer->notify) != 0 || pthread_create(&buffer->thread, NULL, render_main_, buffer) != 0)
+    {
+        fprintf(stderr, "failed to start render thread\n");
+        exit(1);
+    }
+    XtAppAddInput(ui_app(), buffer->notify[0], (XtPointer)XtInputReadMask, render_done_, NULL);
+
     if (DEBUG_LOG)
     {
         fprintf(stderr,
@@ -392,6 +594,7 @@ void shm_destroy_image_(DrawInfo* ctx, Display* dpy)
         return;
     }
     ctx->x_image = NULL;
+    ctx->shm_busy[0] = ctx->shm_busy[1] = 0;
 
 #ifdef FEATURE_SHM
     if (ctx->shminfo.shmid != -1) {
@@ -425,13 +628,18 @@ int shm_prepare_(DrawInfo* ctx, Display* dpy, int w, int h)
     //
     // "there are no "offset", "bitmap_pad", or "bytes_per_line" arguments.
     // These quantities will be defined by the server ... your code needs to abide by them."
-    ctx->shm_image[0] = XShmCreateImage(dpy, ctx->x_visual, 24, ZPixmap, NULL, &ctx->shminfo, w, h);
+    int depth = ctx->x_visual_info.depth;
+    int bytes_per_pixel = ctx->x_format.bytes_per_pixel;
+    ctx->shm_image[0] = XShmCreateImage(dpy, ctx->x_visual, depth, ZPixmap, NULL, &ctx->shminfo, w, h);
 
     if (!ctx->shm_image[0]) {
         return 0;
     }
 
-    if (ctx->shm_image[0]->bytes_per_line != w * sizeof(CcPixel)) {
+    // rows may be padded, bitmaps can follow any stride that holds whole pixels.
+    if (ctx->shm_image[0]->bits_per_pixel != bytes_per_pixel * 8
+            || ctx->shm_image[0]->bytes_per_line < w * bytes_per_pixel
+            || ctx->shm_image[0]->bytes_per_line % bytes_per_pixel != 0) {
         fprintf(stderr, "bad alignment\n");
         XDestroyImage(ctx->shm_image[0]);
         return 0;
@@ -475,10 +683,10 @@ int shm_prepare_(DrawInfo* ctx, Display* dpy, int w, int h)
 
     ctx->shm_image[0]->data = ctx->shminfo.shmaddr;
 
-    ctx->shm_image[1] = XShmCreateImage(dpy, ctx->x_visual, 24, ZPixmap, NULL, &ctx->shminfo, w, h);
+    ctx->shm_image[1] = XShmCreateImage(dpy, ctx->x_visual, depth, ZPixmap, NULL, &ctx->shminfo, w, h);
+    if (!ctx->shm_image[1]) goto cleanup;
     ctx->shm_image[1]->data = ctx->shminfo.shmaddr + image_size;
 
-    if (!ctx->shm_image[1]) goto cleanup;
     return 1;
 
 cleanup:
@@ -487,23 +695,40 @@ cleanup:
 #endif
 }
 
+// leave room to grow, so dragging a window edge
+// doesn't remake (shm) buffers on every step.
+static
+int with_slack_(int x)
+{
+    return (x + x / 4 + 63) & ~63;
+}
+
+// Buffers may be bigger than w x h, drawing uses the top left.
+// returns 1 when the buffers were recreated and hold nothing.
 static
-void framebuffer_prepare_(DrawInfo* buffer, Display* dpy, int w, int h)
+int framebuffer_prepare_(DrawInfo* buffer, Display* dpy, Window window, int w, int h)
 {
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+
     int needs_to_resize = !buffer->x_image
-        || (buffer->x_image->width != w)
-        || (buffer->x_image->height != h);
+        || (buffer->x_image->width < w)
+        || (buffer->x_image->height < h)
+        // give memory back after shrinking a lot
+        || ((long)w * h * 4 < (long)buffer->x_image->width * buffer->x_image->height);
+
+    if (!needs_to_resize) {
+        return 0;
+    }
 
+    int cap_w = with_slack_(w);
+    int cap_h = with_slack_(h);
 
     if (buffer->use_shm)
     {
-        if (!needs_to_resize || w <= 0 || h <= 0) {
-            // swap buffers
-            buffer->shm_index = !buffer->shm_index;
-            buffer->x_image = buffer->shm_image[buffer->shm_index];
-            return;
-        }
-        if (shm_prepare_(buffer, dpy, w, h)) {
+        if (shm_prepare_(buffer, dpy, cap_w, cap_h)) {
+            buffer->shm_index = 0;
             buffer->x_image = buffer->shm_image[0];
         } else {
             fprintf(stderr, "xshm failed. falling back to copying images.\n");
@@ -511,19 +736,12 @@ void framebuffer_prepare_(DrawInfo* buffer, Display* dpy, int w, int h)
         }
     }
 
-    if (!needs_to_resize || w <= 0 || h <= 0) {
-        return;
-    }
-
     if (!buffer->use_shm) {
         if (buffer->x_image) XDestroyImage(buffer->x_image);
+        buffer->x_image = cc_create_ximage(dpy, buffer->x_visual, buffer->x_visual_info.depth, &buffer->x_format, cap_w, cap_h);
 
-        CcBitmap b = {
-            .w = w,
-            .h = h
-        };
-        cc_bitmap_alloc(&b);
-        buffer->x_image = cc_bitmap_create_ximage(&b, dpy, buffer->x_visual);
+        if (buffer->mirror) XFreePixmap(dpy, buffer->mirror);
+        buffer->mirror = XCreatePixmap(dpy, window, cap_w, cap_h, buffer->x_visual_info.depth);
     }
 
     if (!buffer->x_image) {
@@ -531,74 +749,474 @@ void framebuffer_prepare_(DrawInfo* buffer, Display* dpy, int w, int h)
         exit(1);
     }
 
-    assert(buffer->x_image->width == w);
-    assert(buffer->x_image->height == h);
+    if (buffer->x_format.bytes_per_pixel != sizeof(CcPixel))
+    {
+        cc_bitmap_free(&buffer->staging);
+        buffer->staging.w = cap_w;
+        buffer->staging.h = cap_h;
+        cc_bitmap_alloc(&buffer->staging);
+    }
+
+    assert(buffer->x_image->width >= w);
+    assert(buffer->x_image->height >= h);
+    return 1;
 }
 
-void ui_refresh_drawing(int clear)
+#ifdef FEATURE_SHM
+static
+void shm_completed_(DrawInfo* ctx, const XShmCompletionEvent* e)
 {
-    int n = 0;
-    Arg args[UI_ARGS_MAX];
-    PaintContext* ctx = &g_paint_ctx;
+    // may belong to a segment that was already replaced.
+    if (!ctx->shm_image[0] || e->shmseg != ctx->shminfo.shmseg) return;
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (e->offset == (unsigned long)(ctx->shm_image[i]->data - ctx->shminfo.shmaddr))
+        {
+            ctx->shm_busy[i] = 0;
+        }
+    }
+}
+#endif
 
-    Window window = XtWindow(draw_area);
-    Display* dpy = XtDisplay(draw_area);
+// Render thread. Waits until the server is done reading buffer i.
+// https://www.x.org/releases/X11R7.7/doc/xextproto/shm.html
+// "the server sends a ShmCompletion event when it has finished with the image"
+static
+void shm_wait_(DrawInfo* ctx, size_t i)
+{
+#ifdef FEATURE_SHM
+    while (ctx->shm_busy[i])
+    {
+        XEvent event;
+        XNextEvent(ctx->dpy, &event);
+        if (event.type == ctx->shm_event)
+        {
+            shm_completed_(ctx, (XShmCompletionEvent*)&event);
+        }
+    }
+#endif
+}
 
-    DrawInfo* buffer = &g_draw_info;
+// moves the w x h pixels of d by minus (dx, dy)
+static
+void copy_moved_(Display* dpy, Drawable d, GC gc, int w, int h, int dx, int dy)
+{
+    XCopyArea(dpy, d, d, gc,
+            MAX(dx, 0), MAX(dy, 0),
+            w - abs(dx), h - abs(dy),
+            MAX(-dx, 0), MAX(-dy, 0));
+}
 
-    if (clear)
+// Render thread. Moves what the window shows by minus (dx, dy),
+// returns the part that couldn't be copied, because it was covered.
+static
+CcRect scroll_window_(DrawInfo* buffer, Window window, int w, int h, int dx, int dy)
+{
+    copy_moved_(buffer->dpy, window, buffer->x_gc, w, h, dx, dy);
+
+    // https://tronche.com/gui/x/xlib/events/exposure/graphics-expose-and-no-expose.html
+    // the server answers every copy with GraphicsExpose events or one NoExpose.
+    CcRect exposed = { 0 };
+    while (1)
     {
-        resize_view_();
-        update_scroll_();
+        XEvent event;
+        XNextEvent(buffer->dpy, &event);
+        if (event.type == NoExpose) break;
+
+        if (event.type == GraphicsExpose)
+        {
+            const XGraphicsExposeEvent* e = &event.xgraphicsexpose;
+            CcRect r = { e->x, e->y, e->width, e->height };
+            exposed = cc_rect_union(exposed, r);
+            if (e->count == 0) break;
+        }
+#ifdef FEATURE_SHM
+        else if (event.type == buffer->shm_event)
+        {
+            shm_completed_(buffer, (XShmCompletionEvent*)&event);
+        }
+#endif
     }
+    return exposed;
+}
 
-    int w = ctx->viewport.w;
-    int h = ctx->viewport.h;
+// Render thread. Picks the image to draw into,
+// waiting if the server may still read it.
+static
+void upload_begin_(DrawInfo* buffer)
+{
+    if (buffer->use_shm)
+    {
+        // normally done long ago, it was put the frame before last.
+        size_t current = buffer->shm_index;
+        shm_wait_(buffer, current);
+        buffer->x_image = buffer->shm_image[current];
+    }
+}
 
-    framebuffer_prepare_(buffer, dpy, w, h);
+// Render thread. Packs a tile of staging as soon as it is zoomed.
+static
+void pack_tile_(void* ctx, CcRect r)
+{
+    DrawInfo* buffer = ctx;
+    cc_bitmap_pack_ximage(&buffer->staging, buffer->x_image, r, &buffer->x_format);
+}
 
-    CcBitmap b = {
-        .w = w,
-        .h = h,
-        .data = (CcPixel *)buffer->x_image->data
-    };
-    paint_composite(ctx, &b);
-    cc_bitmap_swap_for_xvisual(&b, &buffer->x_visual_info);
+// Render thread. Converts the part r of the snapshot zoomed by v into the image.
+static
+void convert_(DrawInfo* buffer, const CcViewport* v, CcRect r)
+{
+    if (buffer->x_format.bytes_per_pixel == sizeof(CcPixel))
+    {
+        CcBitmap b = {
+            .w = v->w,
+            .h = v->h,
+            .stride = buffer->x_image->bytes_per_line,
+            .data = (CcPixel *)buffer->x_image->data
+        };
+        // pixels already match the usual visual, other formats convert while zooming.
+        paint_zoom_snapshot(v, &buffer->snapshot, &b, cc_row_filter_for_xformat(&buffer->x_format), NULL, NULL, r);
+    }
+    else if (v->zoom == 1)
+    {
+        cc_bitmap_pack_ximage(&buffer->snapshot, buffer->x_image, r, &buffer->x_format);
+    }
+    else
+    {
+        // 16 bit displays send half as much, but need the full pixels to dither from.
+        // Each tile is packed right after it is zoomed, while it is still in cache.
+        CcBitmap staging = buffer->staging;
+        staging.w = v->w;
+        staging.h = v->h;
+        paint_zoom_snapshot(v, &buffer->snapshot, &staging, NULL, pack_tile_, buffer, r);
+    }
+}
 
+// Render thread. Sends the part r of the image to the same place in d.
+static
+void upload_end_(DrawInfo* buffer, Drawable d, CcRect r)
+{
     if (buffer->use_shm) {
 #ifdef FEATURE_SHM
-        XShmPutImage(dpy, window, buffer->x_gc, buffer->x_image, 0, 0, 0, 0, w, h, 0);
+        // the next frame goes into the other buffer while this one is read.
+        size_t current = buffer->shm_index;
+        XShmPutImage(buffer->dpy, d, buffer->x_gc, buffer->x_image, r.x, r.y, r.x, r.y, r.w, r.h, True);
+        buffer->shm_busy[current] = 1;
+        buffer->shm_index = !current;
 #endif
     } else {
-        XPutImage(dpy, window, buffer->x_gc, buffer->x_image, 0, 0, 0, 0, w, h);
+        XPutImage(buffer->dpy, d, buffer->copy_gc, buffer->x_image, r.x, r.y, r.x, r.y, r.w, r.h);
     }
+}
 
-    if (ctx->active_layer == LAYER_OVERLAY)
+#ifdef FEATURE_XRENDER
+// Render thread. Draws damage (viewport pixels) of a zoomed in job
+// by uploading the snapshot and letting the server scale it.
+// The window, or the mirror when there is one, keeps the rest.
+static
+void present_scaled_(DrawInfo* buffer, const RenderJob* job, CcRect damage, CcRect* show)
+{
+    Display* dpy = buffer->dpy;
+    const CcViewport* v = &job->viewport;
+    const CcBitmap* snapshot = &buffer->snapshot;
+
+    // what changed in the snapshot, everything else is already in the source.
+    CcRect upload;
+    cc_viewport_blocks(v, job->damage, &upload);
+
+    if (buffer->scaled_src_w < snapshot->w || buffer->scaled_src_h < snapshot->h)
     {
-        const CcLayer* l = ctx->layers + ctx->active_layer;
-        if (l->bitmap.w != 0)
+        if (buffer->scaled_src_pict) XRenderFreePicture(dpy, buffer->scaled_src_pict);
+        if (buffer->scaled_src) XFreePixmap(dpy, buffer->scaled_src);
+
+        buffer->scaled_src_w = with_slack_(snapshot->w);
+        buffer->scaled_src_h = with_slack_(snapshot->h);
+        buffer->scaled_src = XCreatePixmap(dpy, job->window, buffer->scaled_src_w, buffer->scaled_src_h, buffer->x_visual_info.depth);
+
+        XRenderPictFormat* format = XRenderFindVisualFormat(dpy, buffer->x_visual);
+        buffer->scaled_src_pict = XRenderCreatePicture(dpy, buffer->scaled_src, format, 0, NULL);
+        // blocks of pixels, like cc_bitmap_zoom
+        XRenderSetPictureFilter(dpy, buffer->scaled_src_pict, FilterNearest, NULL, 0);
+        buffer->scaled_zoom = 0;
+    }
+
+    if (buffer->scaled_zoom != v->zoom)
+    {
+        // maps window coordinates to source coordinates: (x, y, zoom) ~ (x / zoom, y / zoom)
+        XTransform transform = { {
+            { XDoubleToFixed(1), XDoubleToFixed(0), XDoubleToFixed(0) },
+            { XDoubleToFixed(0), XDoubleToFixed(1), XDoubleToFixed(0) },
+            { XDoubleToFixed(0), XDoubleToFixed(0), XDoubleToFixed(v->zoom) }
+        } };
+        XRenderSetPictureTransform(dpy, buffer->scaled_src_pict, &transform);
+
+        buffer->scaled_zoom = v->zoom;
+        upload = cc_bitmap_rect(snapshot);
+        damage = (CcRect) { 0, 0, v->w, v->h };
+    }
+    else if (job->scroll.x != 0 || job->scroll.y != 0)
+    {
+        // the snapshot moved, so the source does too.
+        copy_moved_(dpy, buffer->scaled_src, buffer->copy_gc, snapshot->w, snapshot->h,
+                job->scroll.x / v->zoom, job->scroll.y / v->zoom);
+    }
+
+    if (cc_rect_intersect(upload, cc_bitmap_rect(snapshot), &upload))
+    {
+        CcViewport unscaled = { .w = snapshot->w, .h = snapshot->h, .zoom = 1 };
+        upload_begin_(buffer);
+        convert_(buffer, &unscaled, upload);
+        upload_end_(buffer, buffer->scaled_src, upload);
+    }
+
+    Drawable d = buffer->mirror ? buffer->mirror : job->window;
+    if (buffer->scaled_dst != d)
+    {
+        if (buffer->scaled_dst_pict) XRenderFreePicture(dpy, buffer->scaled_dst_pict);
+        XRenderPictFormat* format = XRenderFindVisualFormat(dpy, buffer->x_visual);
+        buffer->scaled_dst_pict = XRenderCreatePicture(dpy, d, format, 0, NULL);
+        buffer->scaled_dst = d;
+    }
+
+    CcRect blocks;
+    if (!cc_rect_intersect(damage, (CcRect) { 0, 0, v->w, v->h }, &damage)) return;
+    CcRect r = cc_viewport_blocks(v, damage, &blocks);
+
+    XRenderComposite(dpy, PictOpSrc, buffer->scaled_src_pict, None, buffer->scaled_dst_pict,
+            r.x, r.y, 0, 0, r.x, r.y, r.w, r.h);
+
+    if (buffer->mirror) *show = cc_rect_union(*show, r);
+}
+#endif
+
+// Render thread. Draws the job from the snapshot.
+static
+void present_(DrawInfo* buffer, const RenderJob* job)
+{
+    Display* dpy = buffer->dpy;
+    const CcViewport* v = &job->viewport;
+    int w = v->w;
+    int h = v->h;
+
+    CcRect damage = job->damage;
+    CcRect all = { 0, 0, w, h };
+    // part of the mirror to show in the window at the end
+    CcRect show = { 0 };
+
+    if (framebuffer_prepare_(buffer, dpy, job->window, w, h))
+    {
+        damage = all;
+    }
+    else if (job->scroll.x != 0 || job->scroll.y != 0)
+    {
+        if (buffer->mirror)
         {
-            int x = (l->x - ctx->viewport.paint_x) * ctx->viewport.zoom;
-            int y = (l->y - ctx->viewport.paint_y) * ctx->viewport.zoom;
-            int w = (l->bitmap.w) * ctx->viewport.zoom - 1;
-            int h = (l->bitmap.h) * ctx->viewport.zoom - 1;
+            // a pixmap is never covered, so all of it moves.
+            // The window is then fixed with a copy, without a round trip.
+            copy_moved_(dpy, buffer->mirror, buffer->copy_gc, w, h, job->scroll.x, job->scroll.y);
+            show = all;
+        }
+        else
+        {
+            CcRect exposed = scroll_window_(buffer, job->window, w, h, job->scroll.x, job->scroll.y);
+            damage = cc_rect_union(damage, exposed);
+        }
+    }
+
+    if (buffer->mirror)
+    {
+        show = cc_rect_union(show, job->expose);
+    }
+    else
+    {
+        damage = cc_rect_union(damage, job->expose);
+    }
 
-            XSetLineAttributes(dpy, buffer->x_gc, 1, LineOnOffDash, CapButt, JoinMiter);
+#ifdef FEATURE_XRENDER
+    if (buffer->use_xrender && v->zoom > 1)
+    {
+        present_scaled_(buffer, job, damage, &show);
+    }
+    else
+#endif
+    {
+#ifdef FEATURE_XRENDER
+        // the snapshot changes without being uploaded
+        buffer->scaled_zoom = 0;
+#endif
+        // puts only read the rect just converted,
+        // so whatever else either shm buffer holds is never shown.
+        if (!cc_rect_empty(damage))
+        {
+            CcRect blocks;
+            CcRect r = cc_viewport_blocks(v, damage, &blocks);
 
-            char dash_pattern[] = { 4, 4 };
-            XSetDashes(dpy, buffer->x_gc, 0, dash_pattern, 2);
-            XSetForeground(dpy, buffer->x_gc, buffer->select_bright.pixel);
-            XDrawRectangle(dpy, window, buffer->x_gc, x, y, w, h);
+            upload_begin_(buffer);
+            convert_(buffer, v, r);
 
-            XSetDashes(dpy, buffer->x_gc, 4, dash_pattern, 2);
-            XSetForeground(dpy, buffer->x_gc, buffer->select_dark.pixel);
-            XDrawRectangle(dpy, window, buffer->x_gc, x, y, w, h);
+            if (buffer->mirror)
+            {
+                upload_end_(buffer, buffer->mirror, r);
+                show = cc_rect_union(show, r);
+            }
+            else
+            {
+                upload_end_(buffer, job->window, r);
+            }
         }
     }
 
+    if (buffer->mirror && cc_rect_intersect(show, all, &show))
+    {
+        XCopyArea(dpy, buffer->mirror, job->window, buffer->copy_gc, show.x, show.y, show.w, show.h, show.x, show.y);
+    }
+
+    if (!cc_rect_empty(job->selection))
+    {
+        CcRect s = job->selection;
+        XSetLineAttributes(dpy, buffer->x_gc, 1, LineOnOffDash, CapButt, JoinMiter);
+
+        char dash_pattern[] = { 4, 4 };
+        XSetDashes(dpy, buffer->x_gc, 0, dash_pattern, 2);
+        XSetForeground(dpy, buffer->x_gc, buffer->select_bright.pixel);
+        XDrawRectangle(dpy, job->window, buffer->x_gc, s.x, s.y, s.w, s.h);
+
+        XSetDashes(dpy, buffer->x_gc, 4, dash_pattern, 2);
+        XSetForeground(dpy, buffer->x_gc, buffer->select_dark.pixel);
+        XDrawRectangle(dpy, job->window, buffer->x_gc, s.x, s.y, s.w, s.h);
+    }
+
     XFlush(dpy);
 }
 
+static
+void* render_main_(void* arg)
+{
+    DrawInfo* buffer = arg;
+
+    pthread_mutex_lock(&buffer->lock);
+    while (1)
+    {
+        while (!buffer->job_ready && !buffer->quit)
+        {
+            pthread_cond_wait(&buffer->wake, &buffer->lock);
+        }
+        if (buffer->quit) break;
+
+        RenderJob job = buffer->job;
+        buffer->job_ready = 0;
+        pthread_mutex_unlock(&buffer->lock);
+
+        present_(buffer, &job);
+
+        pthread_mutex_lock(&buffer->lock);
+        buffer->busy = 0;
+        if (buffer->deferred)
+        {
+            buffer->deferred = 0;
+            char c = 0;
+            if (write(buffer->notify[1], &c, 1) != 1) perror("render notify");
+        }
+    }
+    pthread_mutex_unlock(&buffer->lock);
+    return NULL;
+}
+
+// UI thread. The render thread finished while a refresh was waiting.
+static
+void render_done_(XtPointer client_data, int* fd, XtInputId* id)
+{
+    char c;
+    if (read(*fd, &c, 1) == 1)
+    {
+        ui_refresh_drawing(0);
+    }
+}
+
+void ui_refresh_drawing(int clear)
+{
+    PaintContext* ctx = &g_paint_ctx;
+    DrawInfo* buffer = &g_draw_info;
+
+    if (clear)
+    {
+        resize_view_();
+        update_scroll_();
+        paint_damage_all(ctx);
+    }
+
+    // small enough to keep up with every frame
+    ui_refresh_navigator();
+
+    // Damage keeps adding up in the context
+    // until the render thread lets go of the snapshot.
+    pthread_mutex_lock(&buffer->lock);
+    int busy = buffer->busy;
+    if (busy) buffer->deferred = 1;
+    pthread_mutex_unlock(&buffer->lock);
+
+    if (busy) return;
+
+    const CcViewport* v = &ctx->viewport;
+    int target_w = int_ceil(v->w, v->zoom);
+    int target_h = int_ceil(v->h, v->zoom);
+
+    if (buffer->snapshot.w != target_w || buffer->snapshot.h != target_h)
+    {
+        cc_bitmap_free(&buffer->snapshot);
+        buffer->snapshot.w = target_w;
+        buffer->snapshot.h = target_h;
+        cc_bitmap_alloc(&buffer->snapshot);
+        paint_damage_all(ctx);
+    }
+
+    RenderJob job = {
+        .window = XtWindow(draw_area),
+        .viewport = *v,
+        .expose = buffer->exposed,
+    };
+    buffer->exposed = (CcRect) { 0 };
+
+    // Only moved. The snapshot and the window are shifted,
+    // so just the uncovered strips are composited and sent.
+    CcCoord move;
+    if (paint_collect_scroll(ctx, &move))
+    {
+        cc_bitmap_shift(&buffer->snapshot, move.x, move.y);
+        job.scroll.x = move.x * v->zoom;
+        job.scroll.y = move.y * v->zoom;
+    }
+
+    CcRect damage;
+    if (paint_collect_damage(ctx, &damage))
+    {
+        CcRect blocks;
+        job.damage = cc_viewport_blocks(v, damage, &blocks);
+        paint_snapshot(ctx, &buffer->snapshot, blocks);
+    }
+
+    if (ctx->active_layer == LAYER_OVERLAY)
+    {
+        const CcLayer* l = ctx->layers + ctx->active_layer;
+        if (l->bitmap.w != 0)
+        {
+            job.selection = cc_viewport_from_paint(v, cc_layer_rect(l));
+            job.selection.w -= 1;
+            job.selection.h -= 1;
+        }
+    }
+
+    if (cc_rect_empty(job.damage) && cc_rect_empty(job.expose) && cc_rect_empty(job.selection)) return;
+
+    pthread_mutex_lock(&buffer->lock);
+    buffer->job = job;
+    buffer->job_ready = 1;
+    buffer->busy = 1;
+    pthread_cond_signal(&buffer->wake);
+    pthread_mutex_unlock(&buffer->lock);
+}
+
 Widget ui_setup_scroll_area(Widget parent)
 {
     int n = 0;
@@ -642,11 +1260,29 @@ void ui_drawing_cleanup(void)
 {
     if (draw_area)
     {
-        Display* dpy = XtDisplay(draw_area);
         DrawInfo* ctx = &g_draw_info;
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->quit = 1;
+        pthread_cond_signal(&ctx->wake);
+        pthread_mutex_unlock(&ctx->lock);
+        pthread_join(ctx->thread, NULL);
+
+        Display* dpy = ctx->dpy;
         shm_destroy_image_(ctx, dpy);
         if (ctx->x_image) {
             XDestroyImage(ctx->x_image);
         }
+        cc_bitmap_free(&ctx->staging);
+        cc_bitmap_free(&ctx->snapshot);
+#ifdef FEATURE_XRENDER
+        if (ctx->scaled_dst_pict) XRenderFreePicture(dpy, ctx->scaled_dst_pict);
+        if (ctx->scaled_src_pict) XRenderFreePicture(dpy, ctx->scaled_src_pict);
+        if (ctx->scaled_src) XFreePixmap(dpy, ctx->scaled_src);
+#endif
+        if (ctx->mirror) XFreePixmap(dpy, ctx->mirror);
+        XFreeGC(dpy, ctx->x_gc);
+        XFreeGC(dpy, ctx->copy_gc);
+        XCloseDisplay(dpy);
     }
 }
@@ -240,11 +240,19 @@ void run_tests()
 {
     test_text_wordwrap();
     color_blending_test();
+    resample_test();
+    compositing_test();
 }
 #endif
 
 int main(int argc, char **argv)
 { 
+    if (argc == 2 && strcmp(argv[1], "--bench") == 0)
+    {
+        compositing_benchmark();
+        return 0;
+    }
+
 #if DEBUG_LOG
     run_tests();
 #endif
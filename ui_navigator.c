@@ -0,0 +1,309 @@
+/* 
+ * Copyright (c) 2021 Justin Meiners
+ * 
+ * This program is free software: you can redistribute it and/or modify  
+ * it under the terms of the GNU General Public License as published by  
+ * the Free Software Foundation, version 2.
+ *
+ * This program is distributed in the hope that it will be useful, but 
+ * WITHOUT ANY WARRANTY; without even the implied warranty of 
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU 
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License 
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ui.h"
+
+#include <Xm/DrawingA.h>
+
+// Thumbnail of the whole image with the part in view outlined.
+// Click or drag in it to look somewhere else.
+//
+// The thumbnail is sampled from a mip of LAYER_MAIN (see paint_thumbnail)
+// and kept in a pixmap on the server. An edit only samples, converts
+// and sends the thumbnail pixels it covered.
+
+#define NAVIGATOR_W 120
+#define NAVIGATOR_H 90
+
+typedef struct
+{
+    Widget area;
+    GC gc;
+
+    Pixmap pixmap;
+    XImage* image;
+    CcBitmap thumbnail;
+
+    // size of the image the thumbnail shows
+    int image_w;
+    int image_h;
+
+    // outline of the view on the window, empty when not drawn
+    CcRect view;
+} NavigatorInfo;
+
+static
+NavigatorInfo navigator_;
+
+// nearest pixel of the mip for the part r of the thumbnail
+static
+void sample_(const CcBitmap* level, CcBitmap* thumbnail, CcRect r)
+{
+    for (int y = r.y; y < r.y + r.h; ++y)
+    {
+        const CcPixel* src = cc_bitmap_row(level, (int)((long)y * level->h / thumbnail->h));
+        CcPixel* dst = cc_bitmap_row(thumbnail, y);
+        for (int x = r.x; x < r.x + r.w; ++x)
+        {
+            dst[x] = src[(long)x * level->w / thumbnail->w];
+        }
+    }
+}
+
+// thumbnail pixels reading the part r of the mip
+static
+CcRect from_level_(const CcBitmap* level, const CcBitmap* thumbnail, CcRect r)
+{
+    int x0 = (int)((long)r.x * thumbnail->w / level->w);
+    int y0 = (int)((long)r.y * thumbnail->h / level->h);
+    int x1 = (int)(((long)(r.x + r.w) * thumbnail->w + level->w - 1) / level->w);
+    int y1 = (int)(((long)(r.y + r.h) * thumbnail->h + level->h - 1) / level->h);
+
+    CcRect out = { x0, y0, x1 - x0, y1 - y0 };
+    cc_rect_intersect(out, cc_bitmap_rect(thumbnail), &out);
+    return out;
+}
+
+static
+void upload_(NavigatorInfo* nav, Display* dpy, CcRect r)
+{
+    const CcXFormat* format = ui_draw_format();
+
+    if (format->bytes_per_pixel == sizeof(CcPixel))
+    {
+        CcBitmap image = {
+            .w = nav->image->width,
+            .h = nav->image->height,
+            .stride = nav->image->bytes_per_line,
+            .data = (CcPixel*)nav->image->data
+        };
+        CcBitmap from = cc_bitmap_view(&nav->thumbnail, r);
+        CcBitmap to = cc_bitmap_view(&image, r);
+        cc_bitmap_copy(&from, &to);
+
+        CcRowFilter filter = cc_row_filter_for_xformat(format);
+        if (filter) cc_bitmap_filter(&to, filter);
+    }
+    else
+    {
+        cc_bitmap_pack_ximage(&nav->thumbnail, nav->image, r, format);
+    }
+
+    XPutImage(dpy, nav->pixmap, nav->gc, nav->image, r.x, r.y, r.x, r.y, r.w, r.h);
+}
+
+// fit the image in the navigator, keeping its shape
+static
+void resize_(NavigatorInfo* nav, Display* dpy, Window window, int image_w, int image_h)
+{
+    int w = NAVIGATOR_W;
+    int h = NAVIGATOR_H;
+    if ((long)image_w * NAVIGATOR_H > (long)image_h * NAVIGATOR_W)
+    {
+        h = MAX(1, (int)((long)image_h * NAVIGATOR_W / image_w));
+    }
+    else
+    {
+        w = MAX(1, (int)((long)image_w * NAVIGATOR_H / image_h));
+    }
+
+    nav->image_w = image_w;
+    nav->image_h = image_h;
+
+    if (nav->thumbnail.w == w && nav->thumbnail.h == h) return;
+
+    cc_bitmap_free(&nav->thumbnail);
+    nav->thumbnail.w = w;
+    nav->thumbnail.h = h;
+    cc_bitmap_alloc(&nav->thumbnail);
+
+    Screen* screen = XtScreen(nav->area);
+    if (nav->image) XDestroyImage(nav->image);
+    nav->image = cc_create_ximage(dpy, DefaultVisualOfScreen(screen), DefaultDepthOfScreen(screen), ui_draw_format(), w, h);
+
+    if (nav->pixmap) XFreePixmap(dpy, nav->pixmap);
+    nav->pixmap = XCreatePixmap(dpy, window, w, h, DefaultDepthOfScreen(screen));
+
+    if (!nav->image || !nav->pixmap)
+    {
+        fprintf(stderr, "failed to make navigator image\n");
+        exit(1);
+    }
+}
+
+// the view in thumbnail pixels, clipped to it
+static
+CcRect view_rect_(const NavigatorInfo* nav)
+{
+    const CcViewport* v = &g_paint_ctx.viewport;
+    const CcBitmap* t = &nav->thumbnail;
+
+    int x0 = (int)((long)v->paint_x * t->w / nav->image_w);
+    int y0 = (int)((long)v->paint_y * t->h / nav->image_h);
+    int x1 = (int)((long)(v->paint_x + cc_viewport_paint_w(v)) * t->w / nav->image_w);
+    int y1 = (int)((long)(v->paint_y + cc_viewport_paint_h(v)) * t->h / nav->image_h);
+
+    CcRect r = { x0, y0, MAX(x1 - x0, 2), MAX(y1 - y0, 2) };
+    cc_rect_intersect(r, cc_bitmap_rect(t), &r);
+    return r;
+}
+
+static
+void draw_(NavigatorInfo* nav, Display* dpy, Window window, CcRect r)
+{
+    if (cc_rect_intersect(r, cc_bitmap_rect(&nav->thumbnail), &r))
+    {
+        XCopyArea(dpy, nav->pixmap, window, nav->gc, r.x, r.y, r.w, r.h, r.x, r.y);
+    }
+
+    CcRect s = nav->view;
+    if (cc_rect_empty(s)) return;
+
+    // the same look as the selection outline
+    char dash_pattern[] = { 2, 2 };
+    XSetLineAttributes(dpy, nav->gc, 1, LineOnOffDash, CapButt, JoinMiter);
+    XSetDashes(dpy, nav->gc, 0, dash_pattern, 2);
+    XSetForeground(dpy, nav->gc, WhitePixelOfScreen(XtScreen(nav->area)));
+    XDrawRectangle(dpy, window, nav->gc, s.x, s.y, s.w - 1, s.h - 1);
+
+    XSetDashes(dpy, nav->gc, 2, dash_pattern, 2);
+    XSetForeground(dpy, nav->gc, BlackPixelOfScreen(XtScreen(nav->area)));
+    XDrawRectangle(dpy, window, nav->gc, s.x, s.y, s.w - 1, s.h - 1);
+}
+
+void ui_refresh_navigator(void)
+{
+    NavigatorInfo* nav = &navigator_;
+    PaintContext* ctx = &g_paint_ctx;
+
+    if (!nav->area || !XtIsRealized(nav->area)) return;
+
+    int image_w = paint_w(ctx);
+    int image_h = paint_h(ctx);
+    if (image_w <= 0 || image_h <= 0) return;
+
+    Display* dpy = XtDisplay(nav->area);
+    Window window = XtWindow(nav->area);
+
+    // part of the window to draw again
+    CcRect dirty = { 0 };
+    int resample_all = 0;
+
+    if (image_w != nav->image_w || image_h != nav->image_h)
+    {
+        resize_(nav, dpy, window, image_w, image_h);
+        XClearWindow(dpy, window);
+        nav->view = (CcRect) { 0 };
+        dirty = cc_bitmap_rect(&nav->thumbnail);
+        resample_all = 1;
+    }
+
+    CcRect changed;
+    const CcBitmap* level = paint_thumbnail(ctx, nav->thumbnail.w, nav->thumbnail.h, &changed);
+    if (!level) return;
+
+    if (resample_all) changed = cc_bitmap_rect(level);
+
+    if (!cc_rect_empty(changed))
+    {
+        CcRect r = from_level_(level, &nav->thumbnail, changed);
+        if (!cc_rect_empty(r))
+        {
+            sample_(level, &nav->thumbnail, r);
+            upload_(nav, dpy, r);
+            dirty = cc_rect_union(dirty, r);
+        }
+    }
+
+    CcRect view = view_rect_(nav);
+    if (!cc_rect_equal(view, nav->view))
+    {
+        dirty = cc_rect_union(dirty, nav->view);
+        dirty = cc_rect_union(dirty, view);
+        nav->view = view;
+    }
+
+    if (!cc_rect_empty(dirty)) draw_(nav, dpy, window, dirty);
+}
+
+static
+void cb_navigator_expose_(Widget widget, XtPointer client_data, XtPointer call_data)
+{
+    NavigatorInfo* nav = &navigator_;
+    if (!g_ready || !nav->pixmap) return;
+
+    draw_(nav, XtDisplay(widget), XtWindow(widget), cc_bitmap_rect(&nav->thumbnail));
+}
+
+static
+void cb_navigator_input_(Widget widget, XtPointer client_data, XtPointer call_data)
+{
+    NavigatorInfo* nav = &navigator_;
+    XmDrawingAreaCallbackStruct *cbs = (XmDrawingAreaCallbackStruct*)call_data;
+    XEvent* event = cbs->event;
+
+    if (!g_ready || !nav->pixmap) return;
+
+    int x, y;
+    switch (event->type)
+    {
+        case ButtonPress:
+            if (event->xbutton.button != 1) return;
+            x = event->xbutton.x;
+            y = event->xbutton.y;
+            break;
+        case MotionNotify:
+            x = event->xmotion.x;
+            y = event->xmotion.y;
+            break;
+        default:
+            return;
+    }
+
+    x = interval_clamp(x, 0, nav->thumbnail.w - 1);
+    y = interval_clamp(y, 0, nav->thumbnail.h - 1);
+    ui_center_view(
+            (int)((long)x * nav->image_w / nav->thumbnail.w),
+            (int)((long)y * nav->image_h / nav->thumbnail.h)
+            );
+}
+
+Widget ui_setup_navigator(Widget parent)
+{
+    NavigatorInfo* nav = &navigator_;
+    memset(nav, 0, sizeof(NavigatorInfo));
+
+    int n = 0;
+    Arg args[UI_ARGS_MAX];
+
+    String translations = "<Btn1Down>: DrawingAreaInput()\n \
+                           <Btn1Motion>: DrawingAreaInput()";
+
+    XtSetArg(args[n], XmNtranslations, XtParseTranslationTable(translations)); ++n;
+    XtSetArg(args[n], XmNwidth, NAVIGATOR_W); ++n;
+    XtSetArg(args[n], XmNheight, NAVIGATOR_H); ++n;
+    XtSetArg(args[n], XmNresizePolicy, XmRESIZE_NONE); ++n;
+    nav->area = XmCreateDrawingArea(parent, "navigator", args, n);
+
+    XtAddCallback(nav->area, XmNexposeCallback, cb_navigator_expose_, NULL);
+    XtAddCallback(nav->area, XmNinputCallback, cb_navigator_input_, NULL);
+
+    Display* display = XtDisplay(nav->area);
+    nav->gc = XCreateGC(display, RootWindowOfScreen(XtScreen(nav->area)), 0, NULL);
+
+    XtManageChild(nav->area);
+    return nav->area;
+}
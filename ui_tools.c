@@ -531,6 +531,8 @@ Widget ui_setup_tool_area(Widget parent)
     update_tool_options_(options_list, OPTION_LINE_WIDTH);
     XtManageChild(options_list);
 
+    ui_setup_navigator(tool_option_column);
+
     XtManageChild(tool_option_column);
     return tool_option_column;
 }
@@ -27,22 +27,56 @@ void cb_view_menu_(Widget widget, XtPointer a, XtPointer b)
     {
         case 0:
         {
+            // from 1/8 up to 32 times, through 1.
+            // Zoomed out there is a 3/4 step between the halvings:
+            // 1/8, 3/16, 1/4, 3/8, 1/2, 3/4, 1
             const int max_zoom = 32;
-            int new_zoom = MIN(ctx->viewport.zoom * 2, max_zoom);
-            ctx->viewport = cc_viewport_zoom_centered(&ctx->viewport, new_zoom);
+            int new_zoom = ctx->viewport.zoom;
+            int new_shrink = ctx->viewport.shrink;
+            int new_fraction = ctx->viewport.fraction;
+            if (new_fraction < VIEW_FRACTION_ONE)
+            {
+                new_fraction = VIEW_FRACTION_ONE;
+            }
+            else if (new_shrink > 1)
+            {
+                new_shrink /= 2;
+                new_fraction = VIEW_FRACTION_ONE * 3 / 4;
+            }
+            else
+            {
+                new_zoom = MIN(new_zoom * 2, max_zoom);
+            }
+            ctx->viewport = cc_viewport_zoom_centered(&ctx->viewport, new_zoom, new_shrink, new_fraction);
             break;
         }
         case 1:
         {
-            const int min_zoom = 1;
-            int new_zoom = MAX(ctx->viewport.zoom / 2, min_zoom);
-            ctx->viewport = cc_viewport_zoom_centered(&ctx->viewport, new_zoom);
+            int new_zoom = ctx->viewport.zoom;
+            int new_shrink = ctx->viewport.shrink;
+            int new_fraction = ctx->viewport.fraction;
+            if (new_zoom > 1)
+            {
+                new_zoom /= 2;
+            }
+            else if (new_fraction < VIEW_FRACTION_ONE)
+            {
+                new_shrink *= 2;
+                new_fraction = VIEW_FRACTION_ONE;
+            }
+            else if (new_shrink < VIEW_MAX_SHRINK)
+            {
+                new_fraction = VIEW_FRACTION_ONE * 3 / 4;
+            }
+            ctx->viewport = cc_viewport_zoom_centered(&ctx->viewport, new_zoom, new_shrink, new_fraction);
             break;
         }
         case 3:
             break;
         case 2:
             ctx->viewport.zoom = 1;
+            ctx->viewport.shrink = 1;
+            ctx->viewport.fraction = VIEW_FRACTION_ONE;
             ctx->viewport.paint_x = ctx->viewport.paint_y = 0;
             break;
     }
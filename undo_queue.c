@@ -200,17 +200,12 @@ void cc_undo_record_change(CcUndo* q, const CcLayer *layer, CcRect changed_regio
     }
     else
     {
-        // partial region
+        // partial region.
+        // compress straight out of the layer, no need to copy it first.
         patch.full_image = 0;
 
-        CcBitmap b = {
-            .w = r.w,
-            .h = r.h
-        };
-        cc_bitmap_alloc(&b);
-        cc_bitmap_blit_unsafe(&layer->bitmap, &b, r.x, r.y, 0, 0, r.w, r.h, COLOR_BLEND_REPLACE);
+        CcBitmap b = cc_bitmap_view(&layer->bitmap, r);
         patch.data = cc_bitmap_compress(&b, &patch.data_size);
-        cc_bitmap_free(&b);
 
         ++q->since_last_checkpoint;
     }